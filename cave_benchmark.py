@@ -0,0 +1,56 @@
+"""
+Compares the C cave automaton against the Python one: checks they carve the
+    same caves from the same initial air points and times them.
+
+    python3 cave_benchmark.py [n_chunks]
+"""
+
+import sys
+import random
+from time import time
+
+import terrain, hashrandom
+from data import world_gen
+
+
+def random_grid(x_min, width, rng):
+    max_hill = world_gen['max_hill']
+    row_counts = [2 * (world_gen['ground_height'] + rng.randint(0, max_hill) - 2) for _ in range(width)]
+    initial_rows = [[y for y in range(n) if rng.random() < world_gen['cave_chance']] for n in row_counts]
+    return row_counts, initial_rows
+
+
+def main():
+    if hashrandom.terrain_c is None:
+        print('terrain_c is not built, run `python3 setup.py build` first.')
+        return
+
+    n_chunks = int(sys.argv[1]) if len(sys.argv) > 1 else 20
+    iterations = 6
+    width = world_gen['chunk_size'] + 2 * iterations
+    rng = random.Random(0)
+
+    grids = []
+    for n in range(n_chunks):
+        x_min = n * world_gen['chunk_size'] - iterations
+        grids.append((x_min,) + random_grid(x_min, width, rng))
+
+    times = {}
+    results = {}
+    for name, automaton in (('python', terrain.cave_automaton_py), ('c', hashrandom.terrain_c.cave_automaton)):
+        start = time()
+        results[name] = [automaton(x_min, row_counts, initial_rows, iterations, world_gen['height'], 2)
+                         for x_min, row_counts, initial_rows in grids]
+        times[name] = time() - start
+
+    mismatches = sum(py != c for py, c in zip(results['python'], results['c']))
+
+    print('{} chunks, {} columns each'.format(n_chunks, width))
+    for name, t in times.items():
+        print('{:>8}: {:.2f}ms per chunk'.format(name, 1000 * t / n_chunks))
+    print('Speed up: {:.1f}x'.format(times['python'] / times['c']))
+    print('Mismatched chunks: {}'.format(mismatches))
+
+
+if __name__ == '__main__':
+    main()
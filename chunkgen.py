@@ -0,0 +1,214 @@
+"""
+Generates chunks in a pool of worker processes, ahead of where the players
+    are heading, so walking into new terrain doesn't stall the game loop.
+
+The workers only generate: the parent process saves the chunks and decides
+    when they are published, so chunk files are only ever written from one
+    place.
+
+Run on its own to pregenerate part of a save using all the cores:
+
+    python3 chunkgen.py <save> <x_start> <x_end> [workers]
+"""
+
+import os
+import sys
+import signal
+from time import time
+from threading import Lock
+from concurrent.futures import ProcessPoolExecutor, as_completed
+
+import terrain, saves
+from console import log
+
+
+chunk_size = terrain.world_gen['chunk_size']
+
+
+def _init_worker():
+    # Ctrl-C is for the game, it will shut the pool down.
+    signal.signal(signal.SIGINT, signal.SIG_IGN)
+
+
+def _generate(chunk_n, meta):
+    chunk, slice_heights = terrain.gen_chunk(chunk_n, meta)
+
+    # Strings are much cheaper to send back than lists of characters.
+    return {x: ''.join(slice_) for x, slice_ in chunk.items()}, slice_heights
+
+
+def _unpack(result):
+    chunk, slice_heights = result
+    return {x: list(slice_) for x, slice_ in chunk.items()}, slice_heights
+
+
+def gen_meta(meta):
+    """ The parts of the save meta which world generation depends on. """
+    return {'seed': meta['seed'], 'world_gen_version': meta.get('world_gen_version', 1)}
+
+
+class ChunkGenerator:
+    """
+        Keeps a pool of workers generating the chunks ahead of each player.
+
+        prefetch() and collect() should be called at tick boundaries, and
+            generate() when a chunk is needed straight away.
+    """
+
+    def __init__(self, save, meta, workers, ahead=6, behind=2):
+        self._save = save
+        self._meta = gen_meta(meta)
+        self._ahead = ahead
+        self._behind = behind
+
+        # Version 1 chunks depend on the chunks generated before them, see terrain.gen_chunk_v1.
+        if self._meta['world_gen_version'] < 2:
+            workers = 0
+
+        self._pool = ProcessPoolExecutor(workers, initializer=_init_worker) if workers > 0 else None
+        self._max_pending = workers * 2
+
+        self._lock = Lock()
+        self._pending = {}
+        self._saved = set()
+
+        self._last_x = {}
+        self._direction = {}
+
+    def _is_saved(self, chunk_n):
+        if chunk_n not in self._saved and saves.chunk_exists(self._save, chunk_n):
+            self._saved.add(chunk_n)
+        return chunk_n in self._saved
+
+    def generate(self, chunk_n):
+        """ Generates and saves a chunk, using the pool's result if it is already being generated. """
+
+        with self._lock:
+            future = self._pending.pop(chunk_n, None)
+
+        chunk = None
+        if future is not None:
+            try:
+                chunk, slice_heights = _unpack(future.result())
+            except Exception as e:
+                log('Chunk worker failed', chunk_n, e, m='chunkgen')
+
+        if chunk is None:
+            chunk, slice_heights = terrain.gen_chunk(chunk_n, self._meta)
+
+        saves.save_chunk(self._save, chunk_n, chunk, slice_heights)
+        self._saved.add(chunk_n)
+
+        return chunk, slice_heights
+
+    def _wanted(self, name, x):
+        """ The chunks around x, nearest first, looking further in the direction the player is going. """
+
+        last_x = self._last_x.get(name, x)
+        self._last_x[name] = x
+        if x != last_x:
+            self._direction[name] = 1 if x > last_x else -1
+
+        direction = self._direction.get(name)
+        chunk_n = int(x) // chunk_size
+
+        if direction is None:
+            for d in range(1, self._behind + 1):
+                yield chunk_n + d
+                yield chunk_n - d
+        else:
+            for d in range(1, self._ahead + 1):
+                yield chunk_n + direction * d
+                if d <= self._behind:
+                    yield chunk_n - direction * d
+
+    def prefetch(self, players):
+        """ Queues up the chunks ahead of each player which haven't been generated yet. """
+
+        if self._pool is None:
+            return
+
+        for name, player in players.items():
+            for chunk_n in self._wanted(name, player['x']):
+                with self._lock:
+                    if len(self._pending) >= self._max_pending:
+                        return
+                    if chunk_n in self._pending or self._is_saved(chunk_n):
+                        continue
+
+                    self._pending[chunk_n] = self._pool.submit(_generate, chunk_n, self._meta)
+                    log('Prefetching chunk', chunk_n, 'for', name, m='chunkgen')
+
+    def collect(self):
+        """ Saves the chunks the workers have finished. Returns {chunk_n: (chunk, slice_heights)}. """
+
+        with self._lock:
+            finished = [(chunk_n, future) for chunk_n, future in self._pending.items() if future.done()]
+            for chunk_n, _ in finished:
+                del self._pending[chunk_n]
+
+        chunks = {}
+        for chunk_n, future in finished:
+            # It may have been needed, and generated, before the worker finished.
+            if self._is_saved(chunk_n):
+                continue
+
+            try:
+                chunk, slice_heights = _unpack(future.result())
+            except Exception as e:
+                log('Chunk worker failed', chunk_n, e, m='chunkgen')
+                continue
+
+            saves.save_chunk(self._save, chunk_n, chunk, slice_heights)
+            self._saved.add(chunk_n)
+            chunks[chunk_n] = chunk, slice_heights
+
+        return chunks
+
+    def close(self):
+        if self._pool is not None:
+            self._pool.shutdown(wait=False, cancel_futures=True)
+            self._pool = None
+
+
+def pregenerate(save, x_start, x_end, workers=None):
+    """ Generates and saves every missing chunk between x_start and x_end. """
+
+    meta = gen_meta(saves.get_meta(save))
+    chunk_list = [chunk_n for chunk_n in range(x_start // chunk_size, (x_end - 1) // chunk_size + 1)
+                  if not saves.chunk_exists(save, chunk_n)]
+
+    # Version 1 chunks depend on the chunks generated before them, so are generated in order by one worker.
+    if meta['world_gen_version'] < 2:
+        workers = 1
+
+    print('Generating {} chunks in {}'.format(len(chunk_list), save))
+
+    start = time()
+    with ProcessPoolExecutor(workers or os.cpu_count(), initializer=_init_worker) as pool:
+        futures = {pool.submit(_generate, chunk_n, meta): chunk_n for chunk_n in chunk_list}
+
+        for n, future in enumerate(as_completed(futures), 1):
+            chunk, slice_heights = _unpack(future.result())
+            saves.save_chunk(save, futures[future], chunk, slice_heights)
+            print('\r{}/{}'.format(n, len(chunk_list)), end='', flush=True)
+
+    print('\nDone in {:.1f}s'.format(time() - start))
+
+
+def main():
+    if len(sys.argv) < 4:
+        print(__doc__.strip().split('\n')[-1].strip())
+        return
+
+    save = sys.argv[1]
+    if not os.path.isdir(saves.save_path(save)):
+        print('No save called', save)
+        return
+
+    workers = int(sys.argv[4]) if len(sys.argv) > 4 else None
+    pregenerate(save, int(sys.argv[2]), int(sys.argv[3]), workers)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,75 @@
+"""
+Waits for the next thing the game loop has to do.
+
+The loop sleeps until one of its readers (the keyboard, the network) has
+    input, or one of its named deadlines (the next tick, move, mob spawn or
+    frame) comes round, so input is handled as soon as it arrives and
+    nothing runs while there is nothing to do.
+"""
+
+import selectors
+from time import time, sleep
+
+
+class EventLoop:
+    def __init__(self, poll=None):
+        self._selector = selectors.DefaultSelector()
+        self._readers = set()
+        self._deadlines = {}
+
+        # Longest to sleep for, for when an input can't be waited on (like the Windows console).
+        self.poll = poll
+
+    def add_reader(self, fileobj):
+        """ Returns False if fileobj can't be waited on. """
+
+        try:
+            self._selector.register(fileobj, selectors.EVENT_READ)
+        except (ValueError, OSError):
+            return False
+
+        self._readers.add(fileobj)
+        return True
+
+    def remove_reader(self, fileobj):
+        if fileobj in self._readers:
+            self._selector.unregister(fileobj)
+            self._readers.discard(fileobj)
+
+    def at(self, name, deadline, slack=0):
+        """
+            Sets a named deadline, replacing the last one of the same name. None clears it.
+            A deadline with slack can wait that much longer, so it can share a wake up with another.
+        """
+
+        if deadline is None:
+            self._deadlines.pop(name, None)
+        else:
+            self._deadlines[name] = deadline, slack
+
+    def wait(self):
+        """ Sleeps until a reader is ready or a deadline passes. Returns (ready readers, names of passed deadlines). """
+
+        timeout = None
+        if self._deadlines:
+            timeout = max(0, min(deadline + slack for deadline, slack in self._deadlines.values()) - time())
+        if self.poll is not None:
+            timeout = self.poll if timeout is None else min(timeout, self.poll)
+
+        if self._readers:
+            ready = [key.fileobj for key, _ in self._selector.select(timeout)]
+        else:
+            # Some platforms can't select() with nothing registered.
+            if timeout:
+                sleep(timeout)
+            ready = []
+
+        now = time()
+        due = [name for name, (deadline, _) in self._deadlines.items() if deadline <= now]
+        for name in due:
+            del self._deadlines[name]
+
+        return ready, due
+
+    def close(self):
+        self._selector.close()
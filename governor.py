@@ -0,0 +1,140 @@
+from collections import deque
+from time import time
+
+from console import log
+
+
+# Quality levels, from best to cheapest. Each one is applied on top of the
+#   player's own settings, so it can only ever turn features down.
+LEVELS = (
+    {'name': 'Full'},
+    {'name': 'Half-res lighting', 'lighting_resolution': 2},
+    {'name': 'Fewer lights', 'lighting_resolution': 2, 'max_lights': 8},
+    {'name': 'Quarter-res lighting', 'lighting_resolution': 4, 'max_lights': 8},
+    {'name': 'Basic lights', 'lighting_resolution': 4, 'max_lights': 8, 'fancy_lights': False}
+)
+
+
+def levels(render_c):
+    """ The levels which change something for the renderer. The Python renderer has no lighting_resolution. """
+
+    if render_c:
+        return LEVELS
+
+    kept = []
+    for level in LEVELS:
+        level = {key: value for key, value in level.items() if key != 'lighting_resolution'}
+        if not kept or {**kept[-1], 'name': level['name']} != level:
+            kept.append(level)
+    return tuple(kept)
+
+
+class Governor:
+    """
+        Tracks a moving window of frame times and steps the render quality
+            down when frames overrun their budget, and back up again once
+            there is plenty of headroom.
+
+        The median frame time is used to step down, so one-off hitches (like
+            generating a chunk) don't cost any quality. Stepping up needs the
+            whole window to be well under budget and a delay since the last
+            change, so the level doesn't flicker between two settings.
+    """
+
+    def __init__(self, fps, window=15, up_ratio=.6, up_delay=3):
+        self.budget = 1 / fps
+        self.level = 0
+        self._render_c = True
+        self._levels = LEVELS
+
+        self._window = window
+        self._up_ratio = up_ratio
+        self._up_delay = up_delay
+
+        self._frames = deque(maxlen=window)
+        self._phases = {}
+        self._phase_start = {}
+        self._last_change = time()
+
+    @property
+    def name(self):
+        return self._levels[self.level]['name']
+
+    def start(self, phase):
+        self._phase_start[phase] = time()
+
+    def end(self, phase):
+        d = time() - self._phase_start.pop(phase)
+        self._phases.setdefault(phase, deque(maxlen=self._window)).append(d)
+
+    def frame(self, d_frame, enabled=True, render_c=True):
+        """ Records the time the last frame took. Returns True if the level changed. """
+
+        old_level = self.level
+
+        # Switching renderer starts again from the top of its levels.
+        if render_c != self._render_c:
+            self._render_c = render_c
+            self._levels = levels(render_c)
+            self.level = 0
+            self._frames.clear()
+
+        if not enabled:
+            self.level = 0
+        else:
+            self._frames.append(d_frame)
+
+            if len(self._frames) == self._window:
+                median = sorted(self._frames)[len(self._frames) // 2]
+
+                if median > self.budget and self.level < len(self._levels) - 1:
+                    self.level += 1
+
+                elif (max(self._frames) < self.budget * self._up_ratio and
+                        self.level > 0 and
+                        time() - self._last_change >= self._up_delay):
+                    self.level -= 1
+
+        changed = self.level != old_level
+        if changed:
+            log('Quality level', self.name, self.stats(), m='governor')
+            self._frames.clear()
+            self._last_change = time()
+
+        return changed
+
+    def settings(self, settings):
+        """ Returns a copy of settings with this level's overrides applied. """
+
+        level = self._levels[self.level]
+        if self.level == 0:
+            return settings
+
+        settings = dict(settings)
+
+        if 'fancy_lights' in level:
+            settings['fancy_lights'] = settings.get('fancy_lights') and level['fancy_lights']
+
+        if 'lighting_resolution' in level:
+            settings['lighting_resolution'] = max(settings.get('lighting_resolution', 1), level['lighting_resolution'])
+
+        return settings
+
+    def lights(self, lights, x):
+        """ Keeps only the block lights nearest to x, background lights are always kept. """
+
+        max_lights = self._levels[self.level].get('max_lights')
+        if max_lights is None:
+            return lights
+
+        bk_lights = [l for l in lights if l['z'] != 0]
+        block_lights = sorted((l for l in lights if l['z'] == 0), key=lambda l: abs(l['x'] - x))
+
+        return bk_lights + block_lights[:max_lights]
+
+    def stats(self):
+        mean = lambda d: round(sum(d) / len(d), 4) if d else 0
+
+        stats = {'level': self.level, 'frame': mean(self._frames)}
+        stats.update({phase: mean(times) for phase, times in self._phases.items()})
+        return stats
@@ -0,0 +1,101 @@
+"""
+A stateless random number generator for world generation.
+
+Every value is a SplitMix64 hash of (seed, x, y, feature), so any feature at
+    any position can be computed on its own, in any order, without reseeding
+    a generator. The same functions are implemented in terrain_c for
+    generating whole columns at once.
+"""
+
+import sys, glob
+from hashlib import blake2b
+from functools import lru_cache
+
+from console import log
+
+
+M = (1 << 64) - 1
+GAMMA = 0x9e3779b97f4a7c15
+DOUBLE_UNIT = 1 / (1 << 53)
+
+
+sys.path += glob.glob('build/lib.*')
+try:
+    import terrain_c
+except ImportError:
+    log('Cannot import C terrain module: using Python world generation.', m='warning')
+    terrain_c = None
+
+
+def _mix(z):
+    z = ((z ^ (z >> 30)) * 0xbf58476d1ce4e5b9) & M
+    z = ((z ^ (z >> 27)) * 0x94d049bb133111eb) & M
+    return z ^ (z >> 31)
+
+
+@lru_cache(maxsize=None)
+def string_key(s):
+    """ A 64 bit key for a seed or feature name, stable between runs unlike hash(). """
+    return int.from_bytes(blake2b(str(s).encode(), digest_size=8).digest(), 'little')
+
+
+def hash64(seed, x, y, feature):
+    h = _mix(seed ^ feature)
+    h = _mix((h + (x & M) * GAMMA) & M)
+    return _mix((h + (y & M) * GAMMA) & M)
+
+
+def uniform(seed, x, y, feature):
+    """ A float in [0, 1) for the given position. """
+    return (hash64(seed, x, y, feature) >> 11) * DOUBLE_UNIT
+
+
+def threshold_column(seed, x, feature, n, chance):
+    """ Returns the ys in range(n) where uniform(seed, x, y, feature) < chance. """
+
+    if terrain_c is not None:
+        return terrain_c.threshold_column(seed, x, feature, n, chance)
+
+    return [y for y in range(n) if uniform(seed, x, y, feature) < chance]
+
+
+class HashRandom:
+    """
+        The subset of random.Random used by the terrain generator, drawing
+            values from uniform(seed, x, 0), uniform(seed, x, 1), ...
+    """
+
+    def __init__(self, seed, x, feature):
+        self._seed = seed
+        self._x = x
+        self._feature = feature
+        self._counter = 0
+
+    def _next(self):
+        h = hash64(self._seed, self._x, self._counter, self._feature)
+        self._counter += 1
+        return h
+
+    def random(self):
+        return (self._next() >> 11) * DOUBLE_UNIT
+
+    def _randbelow(self, n):
+        return (self._next() * n) >> 64
+
+    def randint(self, a, b):
+        return a + self._randbelow(b - a + 1)
+
+    def choice(self, seq):
+        return seq[self._randbelow(len(seq))]
+
+    def sample(self, population, k):
+        pool = list(population)
+        if not 0 <= k <= len(pool):
+            raise ValueError('Sample larger than population')
+
+        # Partial Fisher-Yates shuffle
+        for i in range(k):
+            j = i + self._randbelow(len(pool) - i)
+            pool[i], pool[j] = pool[j], pool[i]
+
+        return pool[:k]
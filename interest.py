@@ -0,0 +1,154 @@
+"""
+Area of interest: which clients can see which entities and chunks.
+
+A client sees the chunks its view (its loaded edges) overlaps, and margin
+    chunks either side. Entities are bucketed by the chunk they are in, so
+    the clients which can see an entity are the subscribers of its chunk.
+
+Interest also remembers which entities each client has been sent, so when
+    one leaves a client's chunks, or the client's view moves away from it,
+    the client can be told to forget it.
+"""
+
+from residency import edges_chunks, chunk_size
+
+
+KINDS = ('players', 'mobs', 'items')
+
+
+class Interest:
+    def __init__(self, margin=1):
+        self._margin = margin
+
+        # name: set(chunk_n), and chunk_n: set(name)
+        self._views = {}
+        self._subscribers = {}
+
+        # kind: {id: chunk_n}, and kind: {chunk_n: set(id)}
+        self._positions = {kind: {} for kind in KINDS}
+        self._buckets = {kind: {} for kind in KINDS}
+
+        # kind: {id: set(name)}, and name: {kind: set(id)}
+        self._known_by = {kind: {} for kind in KINDS}
+        self._known = {}
+
+    def set_view(self, name, edges):
+        chunks = set(edges_chunks(edges, self._margin))
+        old_chunks = self._views.get(name, set())
+
+        for chunk_n in old_chunks - chunks:
+            self._unsubscribe(name, chunk_n)
+        for chunk_n in chunks - old_chunks:
+            self._subscribers.setdefault(chunk_n, set()).add(name)
+
+        self._views[name] = chunks
+        self._known.setdefault(name, {kind: set() for kind in KINDS})
+
+    def remove_view(self, name):
+        for chunk_n in self._views.pop(name, ()):
+            self._unsubscribe(name, chunk_n)
+
+        for kind, ids in self._known.pop(name, {}).items():
+            for id_ in ids:
+                self._known_by[kind].get(id_, set()).discard(name)
+
+    def _unsubscribe(self, name, chunk_n):
+        subscribers = self._subscribers[chunk_n]
+        subscribers.discard(name)
+        if not subscribers:
+            del self._subscribers[chunk_n]
+
+    def subscribers(self, chunk_n):
+        return self._subscribers.get(chunk_n, set())
+
+    def move(self, kind, id_, x):
+        """ Updates the chunk an entity is in. """
+
+        chunk_n = int(x) // chunk_size
+        old_chunk_n = self._positions[kind].get(id_)
+
+        if chunk_n != old_chunk_n:
+            if old_chunk_n is not None:
+                self._buckets[kind][old_chunk_n].discard(id_)
+            self._positions[kind][id_] = chunk_n
+            self._buckets[kind].setdefault(chunk_n, set()).add(id_)
+
+    def remove(self, kind, id_):
+        """ Removes an entity, returning the names of the clients which knew about it. """
+
+        chunk_n = self._positions[kind].pop(id_, None)
+        if chunk_n is not None:
+            self._buckets[kind][chunk_n].discard(id_)
+
+        knew = self._known_by[kind].pop(id_, set())
+        for name in knew:
+            self._known[name][kind].discard(id_)
+        return knew
+
+    def ids(self, kind):
+        return list(self._positions[kind].keys())
+
+    def _viewers(self, kind, id_):
+        viewers = set(self._subscribers.get(self._positions[kind].get(id_), ()))
+
+        # Players can always see themselves, even before they have a view.
+        if kind == 'players':
+            viewers.add(id_)
+        return viewers
+
+    def _set_known(self, kind, id_, viewers):
+        knew = self._known_by[kind].get(id_, set())
+
+        for name in knew - viewers:
+            if name in self._known:
+                self._known[name][kind].discard(id_)
+        for name in viewers - knew:
+            self._known.setdefault(name, {k: set() for k in KINDS})[kind].add(id_)
+
+        self._known_by[kind][id_] = viewers
+        return knew
+
+    def route(self, kind, ids):
+        """
+            For entities which have changed, returns {name: (shown, left)}: the
+                ids each client can see, and the ids it knew which it can't see
+                any more.
+        """
+
+        routes = {}
+        for id_ in ids:
+            viewers = self._viewers(kind, id_)
+            knew = self._set_known(kind, id_, viewers)
+
+            for name in viewers:
+                routes.setdefault(name, ([], []))[0].append(id_)
+            for name in knew - viewers:
+                routes.setdefault(name, ([], []))[1].append(id_)
+
+        return routes
+
+    def known(self, name, kind):
+        """ The ids the client has been sent. """
+        return set(self._known.get(name, {}).get(kind, ()))
+
+    def visible(self, name, kind):
+        buckets = self._buckets[kind]
+        return set().union(*(buckets.get(chunk_n, ()) for chunk_n in self._views.get(name, ())))
+
+    def refresh(self, name, kind):
+        """ After a client's view has moved, returns the ids which (entered, left) it. """
+
+        known = set(self._known.get(name, {}).get(kind, ()))
+        visible = self.visible(name, kind)
+        if kind == 'players':
+            visible.add(name)
+
+        for id_ in visible | known:
+            viewers = set(self._known_by[kind].get(id_, ()))
+            if id_ in visible:
+                viewers.add(name)
+            else:
+                viewers.discard(name)
+            self._set_known(kind, id_, viewers)
+
+        return visible - known, known - visible
@@ -0,0 +1,154 @@
+"""
+A write-behind journal of block edits.
+
+Edits are recorded in memory and appended to the save's journal file in
+    batches by a background thread, so breaking a block never waits on the
+    disk. Every so often the journalled edits are compacted into the
+    chunks, many edits to one chunk becoming one write, and the journal is
+    emptied.
+
+If the game stops before a compaction, the journal is replayed into the
+    chunks the next time the save is opened.
+"""
+
+import os
+import struct
+from time import time
+from threading import Thread, Lock, Event
+
+import saves
+from console import log
+
+
+JOURNAL_FILE = 'edits.journal'
+
+# x, y, block
+RECORD = struct.Struct('<qHc')
+
+FLUSH_INTERVAL = 0.1
+COMPACT_INTERVAL = 10
+COMPACT_SIZE = 1024 * 1024
+
+
+class Journal:
+    def __init__(self, save):
+        self._save = save
+        self._path = saves.save_path(save, JOURNAL_FILE)
+
+        self._lock = Lock()
+        self._pending = []
+        # Edits which aren't in the chunks yet: {chunk_n: {(x, y): block}}
+        self._dirty = {}
+        self._compacting = {}
+
+        self._file = None
+        self._replay()
+
+        self._file = open(self._path, 'ab')
+        self._last_compact = time()
+
+        self._stop = Event()
+        self._thread = Thread(target=self._run, daemon=True)
+        self._thread.start()
+
+    def _replay(self):
+        """ Compacts the edits left in the journal by a game which didn't close it. """
+
+        try:
+            with open(self._path, 'rb') as f:
+                data = f.read()
+        except IOError:
+            return
+
+        # A torn record at the end was never acknowledged, so is dropped.
+        n_records = len(data) // RECORD.size
+        for x, y, block in RECORD.iter_unpack(data[:n_records * RECORD.size]):
+            self._dirty.setdefault(saves.chunk_num(x), {})[x, y] = block.decode('ascii')
+
+        if self._dirty:
+            log('Replaying', n_records, 'edits from the journal', m='journal')
+            self._compact()
+
+        os.truncate(self._path, 0)
+
+    def record(self, blocks):
+        """ Records {x: {y: block}}. """
+
+        with self._lock:
+            for x, col in blocks.items():
+                x = int(x)
+                dirty = self._dirty.setdefault(saves.chunk_num(x), {})
+                for y, block in col.items():
+                    y = int(y)
+                    self._pending.append(RECORD.pack(x, y, block.encode('ascii')))
+                    dirty[x, y] = block
+
+    def load_chunk(self, chunk_n):
+        """ Loads a chunk from the save, with the edits which haven't been compacted into it yet. """
+
+        # Holding the region stops a compaction writing the chunk between reading it and applying the edits.
+        with saves.get_region(self._save, chunk_n).lock:
+            chunk, slice_heights = saves.load_chunk(self._save, chunk_n)
+
+            with self._lock:
+                for edits in (self._compacting.get(chunk_n), self._dirty.get(chunk_n)):
+                    for (x, y), block in (edits or {}).items():
+                        if x in chunk:
+                            chunk[x][y] = block
+
+        return chunk, slice_heights
+
+    def _run(self):
+        while not self._stop.wait(FLUSH_INTERVAL):
+            self._flush()
+
+            if (time() - self._last_compact > COMPACT_INTERVAL or
+                    self._file.tell() > COMPACT_SIZE):
+                self._compact()
+
+    def _flush(self):
+        with self._lock:
+            pending = self._pending
+            self._pending = []
+
+        if pending:
+            self._file.write(b''.join(pending))
+            self._file.flush()
+            os.fsync(self._file.fileno())
+
+    def _compact(self):
+        """ Writes the dirty edits into their chunks, and empties the journal. """
+
+        with self._lock:
+            self._compacting = self._dirty
+            self._dirty = {}
+
+        for chunk_n, edits in self._compacting.items():
+            region_ = saves.get_region(self._save, chunk_n)
+            with region_.lock:
+                chunk, slice_heights = saves.load_chunk(self._save, chunk_n)
+                for (x, y), block in edits.items():
+                    if x in chunk:
+                        chunk[x][y] = block
+                saves.save_chunk(self._save, chunk_n, chunk, slice_heights)
+            region_.flush()
+
+        if self._compacting:
+            log('Compacted edits into', len(self._compacting), 'chunks', m='journal')
+
+        with self._lock:
+            self._compacting = {}
+
+        # Everything written so far is in the chunks now.
+        if self._file is not None:
+            self._file.truncate(0)
+            self._file.seek(0)
+        self._last_compact = time()
+
+    def close(self):
+        self._stop.set()
+        self._thread.join()
+
+        self._flush()
+        self._compact()
+        self._file.close()
@@ -0,0 +1,2 @@
+static Colour cave_colour = {{0.1, 0.1, 0.1}};
+
@@ -10,6 +10,8 @@ from console import DEBUG, log, in_game_log, CLS, SHOW_CUR, HIDE_CUR
 from nbinput import NonBlockingInput
 from items import items_to_render_objects
 from events import process_events
+from governor import Governor
+from eventloop import EventLoop
 
 import saves, ui, terrain, player, render, render_interface, server_interface, data
 
@@ -87,6 +89,7 @@ def game(server, settings, benchmarks):
     dinv = False  # Inventory
     dcraft = False  # Crafting
     FPS = 15  # Max
+    FRAME_GAP = 0.8 / FPS  # Shortest gap between frames, a bit under 1/FPS so frames line up with moves
     MPS = 15  # Movement
     SPS = 5  # Mob spawns
 
@@ -95,7 +98,9 @@ def game(server, settings, benchmarks):
     redraw_all = True
     last_move = time()
     last_mob_spawn = time()
+    last_frame = 0
     inp = None
+    move_inp = []
     jump = 0
     cursor = 0
     crafting = False
@@ -106,6 +111,7 @@ def game(server, settings, benchmarks):
     new_blocks = {}
     alive = True
     events = []
+    governor = Governor(FPS)
 
     crafting_list, crafting_sel = player.get_crafting(
         server.inv,
@@ -115,6 +121,14 @@ def game(server, settings, benchmarks):
 
     # Game loop
     with NonBlockingInput() as nbi:
+        # Sleeps between frames until there's input or something is due.
+        #   Without a keyboard to wait on, checks for input every frame.
+        loop = EventLoop()
+        if nbi.fileno() is None or not loop.add_reader(nbi.fileno()):
+            loop.poll = 1 / FPS
+        if server.wake_fd is not None:
+            loop.add_reader(server.wake_fd)
+
         while server.game:
             x, y = server.pos
             dt = server.dt()
@@ -133,6 +147,9 @@ def game(server, settings, benchmarks):
                     if char in 'wasdhkjliuoc-=\n ':
                         inp.append(char)
 
+            # Input is handled when it arrives, but movement waits for the next move.
+            move_inp += inp
+
             # Hard pause
             if DEBUG and '\n' in inp:
                 input()
@@ -149,12 +166,17 @@ def game(server, settings, benchmarks):
             width = settings.get('width')
             height = settings.get('height')
 
+            # Settings with the governor's quality level applied
+            quality = governor.settings(settings)
+
             # Update player and mobs position / damage
             move_period = 1 / MPS
-            while frame_start >= move_period + last_move and x in server.map_:
+            moved = False
+            while frame_start >= move_period + last_move and terrain.slices_loaded(server.map_, x):
+                moved = True
 
                 dx, dy, jump = player.get_pos_delta_on_input(
-                    inp, server.map_, x, y, jump, settings.get('flight'))
+                    move_inp, server.map_, x, y, jump, settings.get('flight'))
                 if dx or dy:
                     dpos = True
                     x += dx
@@ -170,7 +192,7 @@ def game(server, settings, benchmarks):
                             y += 1
                             dpos = True
 
-                if 'h' in inp:
+                if 'h' in move_inp:
                     item = render.blocks[server.inv[inv_sel]['block']] if len(server.inv) else {}
                     server.player_attack(item.get('attack_radius', 5), item.get('attack_damage', 10))
 
@@ -182,6 +204,9 @@ def game(server, settings, benchmarks):
 
                 last_move += move_period
 
+            if moved:
+                move_inp = []
+
             ## Update Map
 
             # Finds display boundaries
@@ -204,18 +229,19 @@ def game(server, settings, benchmarks):
 
             # Moving view
             if not edges == old_edges or server.view_change:
-                extended_view = terrain.move_map(server.map_, extended_edges)
+                extended_view, extended_heights = terrain.move_map(server.map_, server.slice_heights, extended_edges)
                 old_edges = edges
                 server.redraw = True
                 server.view_change = False
 
             # Sun has moved
-            bk_objects, sky_colour, day = render.bk_objects(server.time, width, edges[0], settings.get('fancy_lights'))
+            bk_objects, sky_colour, day = render.bk_objects(server.time, width, edges[0], quality.get('fancy_lights'))
             if not bk_objects == old_bk_objects:
                 old_bk_objects = bk_objects
                 server.redraw = True
 
-            if settings.get('gravity'):
+            # Unloaded slices would look like air, so nothing would be held up by them.
+            if settings.get('gravity') and not slice_list:
                 blocks = terrain.apply_gravity(server.map_, extended_edges)
                 if blocks: server.set_blocks(blocks)
 
@@ -271,10 +297,13 @@ def game(server, settings, benchmarks):
 
             p_hungry = server.health < player.MAX_PLAYER_HEALTH
 
-            new_blocks, server.inv, inv_sel, new_events, dhealth, dinv = \
-                player.cursor_func(
-                    inp, server.map_, x, y, cursor, inv_sel, server.inv, p_hungry
-                )
+            if terrain.slices_loaded(server.map_, x):
+                new_blocks, server.inv, inv_sel, new_events, dhealth, dinv = \
+                    player.cursor_func(
+                        inp, server.map_, x, y, cursor, inv_sel, server.inv, p_hungry
+                    )
+            else:
+                new_blocks, new_events, dhealth, dinv = {}, [], 0, False
 
             server.add_health(dhealth)
 
@@ -296,6 +325,9 @@ def game(server, settings, benchmarks):
                 block = server.map_[x][y+1]
             except IndexError:
                 alive = False
+            except KeyError:
+                # Not loaded yet
+                pass
 
             # Respawn player if dead
             if not alive:
@@ -309,20 +341,34 @@ def game(server, settings, benchmarks):
 
             ## Spawning mobs / Generating lighting buffer
 
-            lights = render.get_lights(extended_view, bk_objects, x)
+            governor.start('lights')
+            all_lights = render.get_lights(extended_view, bk_objects, x)
+            lights = governor.lights(all_lights, x)
+            governor.end('lights')
 
             spawn_period = 1 / SPS
             n_mob_spawn_cycles = int((frame_start - last_mob_spawn) // spawn_period)
             last_mob_spawn += spawn_period * n_mob_spawn_cycles
-            server.spawn_mobs(n_mob_spawn_cycles, bk_objects, sky_colour, day, lights)
+
+            # Mobs spawn by the lighting at the player's own settings, so the quality level doesn't change where.
+            if n_mob_spawn_cycles and quality is not settings:
+                spawn_bk_objects, spawn_sky_colour, _ = render.bk_objects(server.time, width, edges[0], settings.get('fancy_lights'))
+                server.spawn_mobs(n_mob_spawn_cycles, spawn_bk_objects, spawn_sky_colour, day,
+                                  render.get_lights(extended_view, spawn_bk_objects, x))
+            else:
+                server.spawn_mobs(n_mob_spawn_cycles, bk_objects, sky_colour, day, all_lights)
 
             ## Render
 
-            if server.redraw:
+            rendered = server.redraw and frame_start >= last_frame + FRAME_GAP
+            if rendered:
                 server.redraw = False
+                last_frame = frame_start
 
                 # TODO: It would be nice to reuse any of the lighting_buffer generated for the mobs which overlaps with the screen
-                render_interface.create_lighting_buffer(width, height, edges[0], edges_y[0], server.map_, server.slice_heights, bk_objects, sky_colour, day, lights)
+                governor.start('lighting')
+                render_interface.create_lighting_buffer(width, height, edges[0], edges_y[0], extended_view, extended_heights, bk_objects, sky_colour, day, lights, quality)
+                governor.end('lighting')
 
                 entities = {
                     'player': list(server.current_players.values()),
@@ -344,60 +390,84 @@ def game(server, settings, benchmarks):
                         int(width / 2), y, cursor, cursor_colour
                     ))
 
+                crafting_grid = render.render_grid(
+                    player.CRAFT_TITLE, crafting, crafting_list,
+                    height, crafting_sel
+                )
+
+                inv_grid = render.render_grid(
+                    player.INV_TITLE, not crafting, server.inv,
+                    height, inv_sel
+                )
+
+                label = (player.label(crafting_list, crafting_sel)
+                        if crafting else
+                        player.label(server.inv, inv_sel))
+
+                health = 'Health: {}/{}'.format(round(server.health), player.MAX_PLAYER_HEALTH)
+                quality_label = 'Quality: {}'.format(governor.name)
+
+                hud = render.layout_hud(
+                    [
+                        [inv_grid, crafting_grid],
+                        [[label]],
+                        [[health]],
+                        [[quality_label]]
+                    ],
+                    width
+                )
+
                 render_args = [
-                    server.map_,
-                    server.slice_heights,
+                    extended_view,
+                    extended_heights,
                     edges,
                     edges_y,
                     objects,
+                    hud,
                     bk_objects,
                     sky_colour,
                     day,
                     lights,
-                    settings,
+                    quality,
                     redraw_all
                 ]
                 render_map = lambda: render_interface.render_map(*render_args)
 
+                governor.start('render')
                 if benchmarks:
                     timer = timeit.Timer(render_map)
                     t = timer.timeit(1)
                     log('Render call time = {}'.format(t), m="benchmarks")
                 else:
                     render_map()
+                governor.end('render')
 
                 redraw_all = False
 
-                crafting_grid = render.render_grid(
-                    player.CRAFT_TITLE, crafting, crafting_list,
-                    height, crafting_sel
-                )
-
-                inv_grid = render.render_grid(
-                    player.INV_TITLE, not crafting, server.inv,
-                    height, inv_sel
-                )
+                in_game_log('({}, {})'.format(x, y), 0, 0)
 
-                label = (player.label(crafting_list, crafting_sel)
-                        if crafting else
-                        player.label(server.inv, inv_sel))
+            # Only frames which rendered count towards the governor's budget.
+            if rendered:
+                d_frame = time() - frame_start
 
-                health = 'Health: {}/{}'.format(round(server.health), player.MAX_PLAYER_HEALTH)
+                if governor.frame(d_frame, settings.get('adaptive_quality'), settings.get('render_c')):
+                    server.redraw = True
+                if benchmarks:
+                    log('Frame stats', governor.stats(), m='benchmarks')
 
-                render.render_grids(
-                    [
-                        [inv_grid, crafting_grid],
-                        [[label]],
-                        [[health]]
-                    ],
-                    width, height
-                )
+            # Can't move until the chunks have loaded, so check again next frame.
+            next_move = last_move + move_period
+            if next_move <= frame_start:
+                next_move = frame_start + 1 / FPS
 
-                in_game_log('({}, {})'.format(x, y), 0, 0)
+            # Ticks and spawns can wait for the next move, rather than waking up on their own.
+            loop.at('tick', server.next_tick, slack=move_period)
+            loop.at('move', next_move)
+            loop.at('spawn', last_mob_spawn + spawn_period, slack=move_period)
+            loop.at('frame', last_frame + FRAME_GAP if server.redraw else None)
+            loop.wait()
 
-            d_frame = time() - frame_start
-            if d_frame < (1/FPS):
-                sleep((1/FPS) - d_frame)
+        loop.close()
 
 
 if __name__ == '__main__':
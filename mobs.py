@@ -1,12 +1,23 @@
+import sys, glob
 import random
 
-from math import sqrt
+from math import sqrt, ceil
 from uuid import uuid4
+from collections.abc import Mapping, MutableMapping
 
 from console import log
+from colours import lightness
+from data import world_gen, blocks
 
 import player, terrain, items, render_interface, pathfinding
 
+sys.path += glob.glob('build/lib.*')
+try:
+    import mobs_c
+except ImportError:
+    log('Cannot import C mobs module: using Python mob updates.', m='warning')
+    mobs_c = None
+
 
 mob_limit = 100
 mob_rate = 0.1
@@ -22,8 +33,189 @@ spawn_player_range_min = 5
 spawn_player_range = 30
 max_spawn_light_level = 0.3
 
+chunk_size = world_gen['chunk_size']
+
+# Blocks which give off light, {block: (radius, lightness)}, as render.get_lights lights them.
+LIGHT_BLOCKS = {key: (block['light_radius'], lightness(block.get('light_colour', (1, 1, 1))))
+                for key, block in blocks.items() if block.get('light_radius')}
+MAX_LIGHT_RADIUS = max([radius for radius, _ in LIGHT_BLOCKS.values()] + [0])
+
+# The fields mobs_c keeps in arrays, in the order it indexes them.
+STORE_FIELDS = ('x', 'y', 'x_vel', 'health', 'last_attack')
+FIELD_INDEX = {field: i for i, field in enumerate(STORE_FIELDS)}
+MOB_FIELDS = STORE_FIELDS + ('type',)
+
+
+class MobStore(MutableMapping):
+    """
+        The mobs, kept in mobs_c arrays rather than a dict each, so they
+            can all be updated at once. Reads and writes like the dict of
+            {id: mob} it replaces, with a MobView for each mob.
+    """
+
+    def __init__(self, mobs=None):
+        self._store = mobs_c.Store()
+        self._slots = {}
+        self._ids = {}
+        self._types = {}
+
+        if mobs:
+            self.update(mobs)
+
+    def __getitem__(self, id_):
+        if id_ not in self._slots:
+            raise KeyError(id_)
+        return MobView(self, id_)
+
+    def __setitem__(self, id_, mob):
+        slot = self._slots.get(id_)
+        if slot is None:
+            slot = self._store.add(int(mob['x']), int(mob['y']), mob['x_vel'], mob['health'], mob['last_attack'])
+            self._slots[id_] = slot
+            self._ids[slot] = id_
+        else:
+            for field in STORE_FIELDS:
+                self._store.set(slot, FIELD_INDEX[field], mob[field])
+
+        self._types[id_] = mob.get('type', 'mob')
+
+    def __delitem__(self, id_):
+        slot = self._slots.pop(id_)
+        del self._ids[slot]
+        del self._types[id_]
+        self._store.remove(slot)
+
+    def __iter__(self):
+        return iter(self._slots)
+
+    def __len__(self):
+        return len(self._slots)
+
+    def clear(self):
+        self._store = mobs_c.Store()
+        self._slots.clear()
+        self._ids.clear()
+        self._types.clear()
+
+    def step(self, players, map_, last_tick, fields=None):
+        """ Does what update() does, for all the mobs at once. """
+
+        names = list(players.keys())
+        player_fields = [fields and fields.get(name) for name in names]
+        dead, lost, damage = self._store.step(
+            [(int(players[name]['x']), int(players[name]['y'])) for name in names],
+            [field.as_tuple() if field else None for field in player_fields],
+            map_, last_tick, attack_radius, attack_strength, 1 / mob_attack_rate
+        )
+
+        updated_players = {}
+        for name, player_damage in zip(names, damage):
+            if player_damage:
+                players[name]['health'] -= player_damage
+                updated_players[name] = players[name]
+
+        new_items = {}
+        for slot in dead:
+            mob = self[self._ids[slot]]
+            new_items.update(items.new_item(mob['x'], mob['y'], [{'block': '&', 'num': 1}], last_tick))
+            del self[self._ids[slot]]
+
+        for slot in lost:
+            del self[self._ids[slot]]
+
+        return updated_players, new_items
+
+
+class MobView(Mapping):
+    """ One mob in a MobStore. """
+
+    __slots__ = ('_mobs', '_id')
+
+    def __init__(self, mobs, id_):
+        self._mobs = mobs
+        self._id = id_
+
+    def __getitem__(self, field):
+        if field == 'type':
+            return self._mobs._types[self._id]
+        return self._mobs._store.get(self._mobs._slots[self._id], FIELD_INDEX[field])
+
+    def __setitem__(self, field, value):
+        if field == 'type':
+            self._mobs._types[self._id] = value
+        else:
+            self._mobs._store.set(self._mobs._slots[self._id], FIELD_INDEX[field], value)
+
+    def __iter__(self):
+        return iter(MOB_FIELDS)
+
+    def __len__(self):
+        return len(MOB_FIELDS)
+
+
+class SpawnIndex:
+    """
+        The cells mobs can spawn in, by chunk: those with a solid floor and
+            room to stand, with how much daylight and block light reaches
+            them. A chunk's cells are only found again when it loads, or a
+            block in it or in reach of its lights changes.
+    """
+
+    def __init__(self):
+        self._chunks = {}
+        self._stale = set()
+
+    def changed(self, chunk_ns):
+        """ Marks chunks, and the chunks their lights reach, to be rebuilt. """
+
+        reach = ceil(MAX_LIGHT_RADIUS / chunk_size)
+        for chunk_n in chunk_ns:
+            self._stale.update(range(chunk_n - reach, chunk_n + reach + 1))
+
+    def blocks_changed(self, blocks):
+        self.changed({int(x) // chunk_size for x in blocks})
+
+    def remove(self, chunk_ns):
+        for chunk_n in chunk_ns:
+            self._chunks.pop(chunk_n, None)
+            self._stale.discard(chunk_n)
+
+    def _candidates(self, chunk_n, map_, slice_heights):
+        if chunk_n in self._stale or chunk_n not in self._chunks:
+            x = chunk_n * chunk_size
+            if not all(x + dx in map_ for dx in range(chunk_size)):
+                return None
+
+            # Cleared first, so a block changed during the rebuild marks it again.
+            self._stale.discard(chunk_n)
+            self._chunks[chunk_n] = mobs_c.spawn_candidates(map_, slice_heights, x, chunk_size, LIGHT_BLOCKS)
+
+        return self._chunks[chunk_n]
+
+    def sample(self, map_, slice_heights, x_start, y_start, x_end, y_end, day, player_xs, n):
+        """ Returns up to n spots in the area, dark enough and far enough from the players to spawn mobs in. """
+
+        chunks = (self._candidates(chunk_n, map_, slice_heights)
+                  for chunk_n in range(x_start // chunk_size, (x_end - 1) // chunk_size + 1))
+
+        return mobs_c.sample_spawns(
+            [candidates for candidates in chunks if candidates is not None],
+            x_start, x_end, y_start, y_end, day, max_spawn_light_level,
+            [int(x) for x in player_xs], spawn_player_range_min, n, random.getrandbits(64)
+        )
+
+
+def new_store(mobs):
+    """ Returns the mobs in a MobStore, or as they are without mobs_c. """
+    return mobs if mobs_c is None else MobStore(mobs)
+
+
+def update(mobs, players, map_, last_tick, fields=None):
+    """ Moves the mobs towards the closest player, along their flow field in fields if they have one. """
+
+    if isinstance(mobs, MobStore):
+        return mobs.step(players, map_, last_tick, fields)
 
-def update(mobs, players, map_, last_tick):
     updated_players = {}
     updated_mobs = {}
     removed_mobs = []
@@ -37,7 +229,8 @@ def update(mobs, players, map_, last_tick):
             new_items.update(items.new_item(mx, my, [{'block': '&', 'num': 1}], last_tick))
 
         else:
-            closest_player_dist = min(map(lambda p: abs(p['x'] - mx), players.values()))
+            closest_name = min(players, key=lambda name: abs(players[name]['x'] - mx))
+            closest_player_dist = abs(players[closest_name]['x'] - mx)
 
             if (abs(closest_player_dist) < attack_radius and
                 mob['last_attack'] + (1 / mob_attack_rate) <= last_tick):
@@ -45,6 +238,9 @@ def update(mobs, players, map_, last_tick):
                 updated_players.update(calculate_mob_attack(mx, my, attack_radius, attack_strength, players))
                 mob['last_attack'] = last_tick
 
+            elif pathfinding.follow_field(mob, fields and fields.get(closest_name)):
+                updated_mobs[mob_id] = mob
+
             else:
                 updated, kill_mob = pathfinding.pathfind_towards_delta(mob, closest_player_dist, map_)
                 if updated:
@@ -97,20 +293,43 @@ def spawn(mobs, players, map_, x_start_range, y_start_range, x_end_range, y_end_
                       not closest_player_dist < spawn_player_range_min)
 
         if spot_found:
-            new_mobs[str(uuid4())] = {
-                'x': mx,
-                'y': my,
-                'x_vel': 0,
-                'health': max_mob_health,
-                'type': 'mob',
-                'last_attack': 0
-            }
+            new_mobs[str(uuid4())] = new_mob(mx, my)
 
     mobs.update(new_mobs)
 
     return new_mobs
 
 
+def spawn_indexed(mobs, players, index, map_, slice_heights, x_start_range, y_start_range, x_end_range, y_end_range, day):
+    """ Like spawn, but picks the spots from a SpawnIndex, so needs no lighting buffer. """
+
+    log("spawning", x_start_range, x_end_range, m='mobs');
+
+    n_mobs_to_spawn = random.randint(0, 5) if random.random() < mob_rate else 0
+    n_mobs_to_spawn = min(n_mobs_to_spawn, mob_limit - len(mobs))
+    if n_mobs_to_spawn <= 0:
+        return {}
+
+    spots = index.sample(map_, slice_heights, x_start_range, y_start_range, x_end_range, y_end_range, day,
+                         [p['x'] for p in players.values()], n_mobs_to_spawn)
+    new_mobs = {str(uuid4()): new_mob(mx, my) for mx, my in spots}
+
+    mobs.update(new_mobs)
+
+    return new_mobs
+
+
+def new_mob(x, y):
+    return {
+        'x': x,
+        'y': y,
+        'x_vel': 0,
+        'health': max_mob_health,
+        'type': 'mob',
+        'last_attack': 0
+    }
+
+
 def calculate_attack(entity, ax, ay, radius, strength):
     dist_from_attack_sq = (ax - entity['x'])**2 + (ay - entity['y'])**2
     success = False
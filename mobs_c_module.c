@@ -0,0 +1,1268 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <math.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "render.h"
+
+#include "colours.c"
+#include "data.c"
+
+
+// Fields of a mob, in the order get and set index them, see mobs.STORE_FIELDS.
+enum
+{
+    FIELD_X,
+    FIELD_Y,
+    FIELD_X_VEL,
+    FIELD_HEALTH,
+    FIELD_LAST_ATTACK,
+    N_FIELDS
+};
+
+#define INITIAL_CAPACITY 128
+
+// Flow field cells, see pathfinding.py
+#define CELL_SOLID 1
+#define CELL_LADDER 2
+
+// Steps in a flow field: none, already there, or one of MOVES.
+#define STEP_NONE 0
+#define STEP_ARRIVED 1
+#define STEP_MOVE 2
+
+// (dx, dy) of each move, in the same order as pathfinding.MOVES.
+static const long MOVES[][2] = {{-1, 0}, {1, 0}, {-1, -1}, {1, -1}, {0, -1}, {0, 1}};
+#define N_MOVES 6
+
+// How far the daylight fades in to the ground, see add_daylight_lightness_to_lighting_buffer in render_c
+#define GROUND_FADE 3
+
+// Blocks with keys from here up can't give off light.
+#define MAX_LIGHT_BLOCKS 128
+
+// Players are hashed by which PLAYER_CELL wide column of the world they are in.
+#define PLAYER_CELL 16
+#define PLAYER_BUCKETS 64
+
+
+PyObject *C_MOBS_EXCEPTION;
+
+
+// A cell a mob could spawn in: with a solid floor, and room for its feet and head.
+typedef struct
+{
+    int32_t x;
+    int32_t y;
+
+    // How much of the daylight, and how much light from blocks, reaches the lighter of its two cells.
+    float sky;
+    float light;
+} SpawnCandidate;
+
+
+typedef struct
+{
+    PyObject_HEAD
+
+    // Slots [0, n) have been used, the removed ones are on the free list to be reused.
+    long n;
+    long capacity;
+    long *free_slots;
+    long n_free;
+
+    char *alive;
+    long *x;
+    long *y;
+    double *x_vel;
+    double *health;
+    double *last_attack;
+} Store;
+
+
+typedef struct
+{
+    long x;
+    long y;
+    long width;
+    long height;
+    const char *steps;
+} Field;
+
+
+typedef struct
+{
+    long n;
+    long *x;
+    long *y;
+
+    // Each player's flow field, or steps is NULL if they don't have one.
+    Field *fields;
+
+    // Players in each bucket, linked through next, -1 ends a bucket.
+    long head[PLAYER_BUCKETS];
+    long *next;
+
+    long cell_min;
+    long cell_max;
+} Players;
+
+
+static inline long
+cell_of(long x)
+{
+    return x >= 0 ? x / PLAYER_CELL : -((-x - 1) / PLAYER_CELL) - 1;
+}
+
+
+static inline long
+bucket_of(long cell)
+{
+    return cell & (PLAYER_BUCKETS - 1);
+}
+
+
+// The steps in the fields are borrowed, py_fields must outlive players.
+static bool
+players_init(Players *players, PyObject *py_players, PyObject *py_fields)
+{
+    long n = PySequence_Fast_GET_SIZE(py_players);
+
+    if (PySequence_Fast_GET_SIZE(py_fields) != n)
+    {
+        PyErr_SetString(C_MOBS_EXCEPTION, "players and fields must be the same length!");
+        return false;
+    }
+
+    players->n = n;
+    players->x = (long *)malloc((n + 1) * sizeof(long));
+    players->y = (long *)malloc((n + 1) * sizeof(long));
+    players->next = (long *)malloc((n + 1) * sizeof(long));
+    players->fields = (Field *)calloc(n + 1, sizeof(Field));
+    if (!players->x || !players->y || !players->next || !players->fields)
+    {
+        PyErr_NoMemory();
+        return false;
+    }
+
+    long i;
+    for (i = 0; i < PLAYER_BUCKETS; ++i)
+    {
+        players->head[i] = -1;
+    }
+    players->cell_min = LONG_MAX;
+    players->cell_max = LONG_MIN;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(py_players, i), "ll:players", &players->x[i], &players->y[i]))
+            return false;
+
+        long cell = cell_of(players->x[i]);
+        players->next[i] = players->head[bucket_of(cell)];
+        players->head[bucket_of(cell)] = i;
+
+        if (cell < players->cell_min)
+            players->cell_min = cell;
+        if (cell > players->cell_max)
+            players->cell_max = cell;
+
+        PyObject *py_field = PySequence_Fast_GET_ITEM(py_fields, i);
+        if (py_field != Py_None)
+        {
+            Field *field = &players->fields[i];
+            Py_ssize_t size;
+            if (!PyArg_ParseTuple(py_field, "lllly#:fields", &field->x, &field->y, &field->width, &field->height, &field->steps, &size))
+                return false;
+
+            if (size != field->width * field->height)
+            {
+                PyErr_SetString(C_MOBS_EXCEPTION, "Flow field is the wrong size!");
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+static void
+players_free(Players *players)
+{
+    free(players->x);
+    free(players->y);
+    free(players->next);
+    free(players->fields);
+}
+
+
+// The closest player in x, searching the cells outwards from x. Sets distance to how far it is.
+static long
+closest_player(Players *players, long x, long *distance)
+{
+    long best = LONG_MAX;
+    long best_i = -1;
+    long cell = cell_of(x);
+
+    long max_ring = cell - players->cell_min;
+    if (players->cell_max - cell > max_ring)
+        max_ring = players->cell_max - cell;
+
+    // Players far away are found quicker by checking all of them.
+    bool capped = max_ring > PLAYER_BUCKETS / 2;
+    if (capped)
+        max_ring = PLAYER_BUCKETS / 2;
+
+    long ring;
+    for (ring = 0; ring <= max_ring; ++ring)
+    {
+        // Nothing in this ring or further out can be closer.
+        if (ring > 0 && (ring - 1) * PLAYER_CELL >= best)
+            break;
+
+        long side;
+        for (side = -1; side <= 1; side += 2)
+        {
+            long ring_cell = cell + side * ring;
+            long i;
+            for (i = players->head[bucket_of(ring_cell)]; i >= 0; i = players->next[i])
+            {
+                // Ties go to the first player, like min() in mobs.update
+                long d = labs(players->x[i] - x);
+                if (cell_of(players->x[i]) == ring_cell && (d < best || (d == best && i < best_i)))
+                {
+                    best = d;
+                    best_i = i;
+                }
+            }
+
+            if (ring == 0)
+                break;
+        }
+    }
+
+    if (best_i < 0 || (capped && (max_ring - 1) * PLAYER_CELL < best))
+    {
+        long i;
+        for (i = 0; i < players->n; ++i)
+        {
+            if (labs(players->x[i] - x) < best)
+            {
+                best = labs(players->x[i] - x);
+                best_i = i;
+            }
+        }
+    }
+
+    *distance = best;
+    return best_i;
+}
+
+
+// Adds the damage an attack at (x, y) does to each player in the radius, see mobs.calculate_attack.
+static void
+attack_players(Players *players, long x, long y, double radius, double strength, double *damage)
+{
+    long cell;
+    for (cell = cell_of((long)floor(x - radius)); cell <= cell_of((long)ceil(x + radius)); ++cell)
+    {
+        long i;
+        for (i = players->head[bucket_of(cell)]; i >= 0; i = players->next[i])
+        {
+            if (cell_of(players->x[i]) != cell)
+                continue;
+
+            double dx = x - players->x[i];
+            double dy = y - players->y[i];
+            double dist_sq = dx * dx + dy * dy;
+            if (dist_sq <= radius * radius)
+            {
+                damage[i] += (1 - (sqrt(dist_sq) / radius)) * strength;
+            }
+        }
+    }
+}
+
+
+// Whether column x is loaded. Leaves an exception set on error.
+static bool
+in_map(PyObject *map, long x)
+{
+    PyObject *py_x = PyLong_FromLong(x);
+    if (!py_x)
+        return false;
+
+    int result = PyDict_Contains(map, py_x);
+    Py_DECREF(py_x);
+    return result == 1;
+}
+
+
+// Whether the block at (x, y) is solid, indexing the column as Python
+//   would. Blocks outside the map aren't. Leaves an exception set on error.
+static bool
+is_solid(PyObject *map, long x, long y)
+{
+    PyObject *py_x = PyLong_FromLong(x);
+    if (!py_x)
+        return false;
+
+    PyObject *column = PyDict_GetItemWithError(map, py_x);
+    Py_DECREF(py_x);
+    if (!column)
+        return false;
+
+    Py_ssize_t size = PySequence_Size(column);
+    if (size < 0)
+        return false;
+    if (y < 0)
+        y += size;
+    if (y < 0 || y >= size)
+        return false;
+
+    PyObject *block = PySequence_GetItem(column, y);
+    if (!block)
+        return false;
+
+    bool result = false;
+    if (PyUnicode_Check(block) && PyUnicode_GET_LENGTH(block) > 0)
+    {
+        Py_UCS4 key = PyUnicode_READ_CHAR(block, 0);
+        BlockData *block_data = key < 128 ? get_block_data((char)key) : NULL;
+        result = block_data && block_data->solid;
+    }
+    Py_DECREF(block);
+
+    return result;
+}
+
+
+// See player.get_pos_delta
+static void
+get_pos_delta(PyObject *map, long x, long y, long *dx, long *dy)
+{
+    long next_x = x + *dx;
+    long checked_dx = 0;
+    *dy = 0;
+
+    if (!is_solid(map, next_x, y - 1))
+    {
+        if (is_solid(map, next_x, y))
+        {
+            if (!is_solid(map, next_x, y - 2) && !is_solid(map, x, y - 2))
+            {
+                *dy = -1;
+                checked_dx = *dx;
+            }
+        }
+        else
+        {
+            checked_dx = *dx;
+        }
+    }
+
+    *dx = checked_dx;
+}
+
+
+// Moves a mob, see pathfinding.pathfind_towards_delta. Returns false if it
+//   has walked off the loaded map and should be removed.
+static bool
+pathfind_towards_delta(Store *self, long slot, long delta, PyObject *map)
+{
+    double x_vel = self->x_vel[slot] + delta / 100.0;
+    if (fabs(x_vel) > 1)
+        x_vel = x_vel / fabs(x_vel);
+
+    // Rounds halves to even, like Python's round()
+    long dx = (long)nearbyint(x_vel);
+    long dy;
+    long x = self->x[slot];
+    long y = self->y[slot];
+
+    if (!in_map(map, x + dx - 1) || !in_map(map, x + dx) || !in_map(map, x + dx + 1))
+        return false;
+
+    get_pos_delta(map, x, y, &dx, &dy);
+    x += dx;
+    y += dy;
+
+    if (!is_solid(map, x, y + 1))
+        y += 1;
+
+    self->x[slot] = x;
+    self->y[slot] = y;
+    self->x_vel[slot] = x_vel;
+
+    return true;
+}
+
+
+// Moves a mob a step along a flow field. Returns false if the field has no step for it.
+static bool
+follow_field(Store *self, long slot, Field *field)
+{
+    long i = self->x[slot] - field->x;
+    long j = self->y[slot] - field->y;
+    if (!field->steps || i < 0 || i >= field->width || j < 0 || j >= field->height)
+        return false;
+
+    char step = field->steps[j * field->width + i];
+    if (step == STEP_NONE)
+        return false;
+
+    if (step >= STEP_MOVE)
+    {
+        const long *move = MOVES[step - STEP_MOVE];
+        self->x[slot] += move[0];
+        self->y[slot] += move[1];
+        self->x_vel[slot] = move[0];
+    }
+
+    return true;
+}
+
+
+// Reads the window of the map into cells, blocks outside the map are solid.
+static bool
+read_cells(PyObject *map, long x0, long y0, long width, long height, char *cells)
+{
+    long i;
+    for (i = 0; i < width; ++i)
+    {
+        PyObject *py_x = PyLong_FromLong(x0 + i);
+        if (!py_x)
+            return false;
+
+        PyObject *column = PyDict_GetItemWithError(map, py_x);
+        Py_DECREF(py_x);
+        if (!column && PyErr_Occurred())
+            return false;
+
+        Py_ssize_t size = column ? PySequence_Size(column) : 0;
+        if (size < 0)
+            return false;
+
+        long j;
+        for (j = 0; j < height; ++j)
+        {
+            long y = y0 + j;
+            char cell = CELL_SOLID;
+
+            if (y >= 0 && y < size)
+            {
+                PyObject *block = PySequence_GetItem(column, y);
+                if (!block)
+                    return false;
+
+                if (PyUnicode_Check(block) && PyUnicode_GET_LENGTH(block) > 0)
+                {
+                    Py_UCS4 key = PyUnicode_READ_CHAR(block, 0);
+                    BlockData *block_data = key < 128 ? get_block_data((char)key) : NULL;
+                    cell = (block_data && block_data->solid) ? CELL_SOLID : 0;
+                    if (key == '=')
+                        cell |= CELL_LADDER;
+                }
+                Py_DECREF(block);
+            }
+
+            cells[j * width + i] = cell;
+        }
+    }
+
+    return true;
+}
+
+
+// Whether a mob standing at (i, j) in the cells can make the move, see pathfinding.can_move
+static bool
+can_move(const char *cells, long width, long height, long i, long j, long move)
+{
+    #define SOLID(ci, cj) ((ci) < 0 || (ci) >= width || (cj) < 0 || (cj) >= height || (cells[(cj) * width + (ci)] & CELL_SOLID))
+    #define LADDER(ci, cj) (!SOLID(ci, cj) && (cells[(cj) * width + (ci)] & CELL_LADDER))
+    #define OPEN(ci, cj) (!SOLID(ci, cj) && !SOLID(ci, (cj) - 1))
+
+    long dx = MOVES[move][0];
+    long dy = MOVES[move][1];
+    bool result = false;
+
+    if (!OPEN(i, j))
+        result = false;
+
+    // Falling is all a mob can do with nothing to stand on.
+    else if (!SOLID(i, j + 1) && !LADDER(i, j))
+        result = dx == 0 && dy == 1;
+
+    else if (dx != 0 && dy == 0)
+        result = OPEN(i + dx, j);
+
+    // Stepping up, like player.get_pos_delta
+    else if (dx != 0)
+        result = SOLID(i + dx, j) && OPEN(i + dx, j - 1) && !SOLID(i, j - 2);
+
+    // Climbing up or down a ladder
+    else if (dy == -1)
+        result = LADDER(i, j) && OPEN(i, j - 1);
+    else
+        result = LADDER(i, j + 1) && OPEN(i, j + 1);
+
+    #undef OPEN
+    #undef LADDER
+    #undef SOLID
+
+    return result;
+}
+
+
+static PyObject *
+flow_field(PyObject *self, PyObject *args)
+{
+    PyObject *map;
+    long x0, y0, width, height, target_x, target_y;
+
+    if (!PyArg_ParseTuple(args, "O!llllll:flow_field", &PyDict_Type, &map, &x0, &y0, &width, &height, &target_x, &target_y))
+        return NULL;
+
+    if (width <= 0 || height <= 0)
+    {
+        PyErr_SetString(C_MOBS_EXCEPTION, "Flow field must have an area!");
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    long n_cells = width * height;
+    char *cells = (char *)malloc(n_cells);
+    char *steps = (char *)calloc(n_cells, 1);
+    long *queue = (long *)malloc(n_cells * sizeof(long));
+    if (!cells || !steps || !queue)
+    {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if (!read_cells(map, x0, y0, width, height, cells))
+        goto done;
+
+    // Breadth first out from the target, each cell reached steps to the one it was reached from.
+    long head = 0, tail = 0;
+    long target_i = target_x - x0;
+    long target_j = target_y - y0;
+    if (target_i >= 0 && target_i < width && target_j >= 0 && target_j < height)
+    {
+        steps[target_j * width + target_i] = STEP_ARRIVED;
+        queue[tail++] = target_j * width + target_i;
+    }
+
+    while (head < tail)
+    {
+        long cell = queue[head++];
+        long i = cell % width;
+        long j = cell / width;
+
+        long move;
+        for (move = 0; move < N_MOVES; ++move)
+        {
+            long from_i = i - MOVES[move][0];
+            long from_j = j - MOVES[move][1];
+            if (from_i < 0 || from_i >= width || from_j < 0 || from_j >= height)
+                continue;
+
+            long from = from_j * width + from_i;
+            if (steps[from] == STEP_NONE && can_move(cells, width, height, from_i, from_j, move))
+            {
+                steps[from] = STEP_MOVE + move;
+                queue[tail++] = from;
+            }
+        }
+    }
+
+    result = PyBytes_FromStringAndSize(steps, n_cells);
+
+done:
+    free(cells);
+    free(steps);
+    free(queue);
+    return result;
+}
+
+
+// SplitMix64, as in terrain_c
+static inline uint64_t
+mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+static inline uint64_t
+next_random(uint64_t *state)
+{
+    *state += 0x9e3779b97f4a7c15ULL;
+    return mix(*state);
+}
+
+
+// The keys of the blocks in columns [x, x + width), 0 where it isn't loaded.
+static bool
+read_columns(PyObject *map, long x, long width, long height, char *keys)
+{
+    memset(keys, 0, width * height);
+
+    long i;
+    for (i = 0; i < width; ++i)
+    {
+        PyObject *py_x = PyLong_FromLong(x + i);
+        if (!py_x)
+            return false;
+
+        PyObject *column = PyDict_GetItemWithError(map, py_x);
+        Py_DECREF(py_x);
+        if (!column)
+        {
+            if (PyErr_Occurred())
+                return false;
+            continue;
+        }
+
+        Py_ssize_t size = PySequence_Size(column);
+        if (size < 0)
+            return false;
+
+        long y;
+        for (y = 0; y < height && y < size; ++y)
+        {
+            PyObject *block = PySequence_GetItem(column, y);
+            if (!block)
+                return false;
+
+            if (PyUnicode_Check(block) && PyUnicode_GET_LENGTH(block) > 0)
+            {
+                Py_UCS4 key = PyUnicode_READ_CHAR(block, 0);
+                keys[i * height + y] = key < 128 ? (char)key : 0;
+            }
+            Py_DECREF(block);
+        }
+    }
+
+    return true;
+}
+
+
+// Lights reach out to their radius in x, and half of it in y, see circle_dist in render_c
+static inline float
+circle_dist(float test_x, float test_y, float x, float y, float r)
+{
+    return ( pow(test_x - x, 2.0f) / pow(r    , 2.0f) +
+             pow(test_y - y, 2.0f) / pow(r*.5f, 2.0f) );
+}
+
+
+static inline bool
+key_is_solid(char key)
+{
+    BlockData *block_data = key ? get_block_data(key) : NULL;
+    return block_data && block_data->solid;
+}
+
+
+static PyObject *
+spawn_candidates(PyObject *self, PyObject *args)
+{
+    PyObject *map, *slice_heights, *light_blocks;
+    long x, width;
+
+    if (!PyArg_ParseTuple(args, "O!O!llO!:spawn_candidates", &PyDict_Type, &map, &PyDict_Type, &slice_heights, &x, &width, &PyDict_Type, &light_blocks))
+        return NULL;
+
+    // key: (radius, lightness) of each block which gives off light
+    long light_radius[MAX_LIGHT_BLOCKS] = {0};
+    float light_lightness[MAX_LIGHT_BLOCKS] = {0};
+    long max_radius = 0;
+
+    PyObject *py_key, *py_light;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(light_blocks, &pos, &py_key, &py_light))
+    {
+        long radius;
+        double lightness;
+        if (!PyUnicode_Check(py_key) || PyUnicode_GET_LENGTH(py_key) != 1 ||
+            !PyArg_ParseTuple(py_light, "ld:light_blocks", &radius, &lightness))
+        {
+            if (!PyErr_Occurred())
+                PyErr_SetString(C_MOBS_EXCEPTION, "light_blocks must be {block: (radius, lightness)}!");
+            return NULL;
+        }
+
+        Py_UCS4 key = PyUnicode_READ_CHAR(py_key, 0);
+        if (key < MAX_LIGHT_BLOCKS)
+        {
+            light_radius[key] = radius;
+            light_lightness[key] = lightness;
+            if (radius > max_radius)
+                max_radius = radius;
+        }
+    }
+
+    PyObject *result = NULL;
+    long height = world_gen_height;
+    long read_x = x - max_radius;
+    long read_width = width + 2 * max_radius;
+
+    char *keys = (char *)malloc(read_width * height);
+    SpawnCandidate *candidates = (SpawnCandidate *)malloc(width * height * sizeof(SpawnCandidate));
+    if (!keys || !candidates)
+    {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    if (!read_columns(map, read_x, read_width, height, keys))
+        goto done;
+
+    #define KEY(cx, cy) keys[((cx) - read_x) * height + (cy)]
+
+    long n = 0;
+    long cx;
+    for (cx = x; cx < x + width; ++cx)
+    {
+        PyObject *py_x = PyLong_FromLong(cx);
+        if (!py_x)
+            goto done;
+        PyObject *py_slice_height = PyDict_GetItemWithError(slice_heights, py_x);
+        Py_DECREF(py_x);
+        if (!py_slice_height)
+        {
+            if (!PyErr_Occurred())
+                PyErr_Format(C_MOBS_EXCEPTION, "No slice height for %ld!", cx);
+            goto done;
+        }
+
+        long ground_y = height - (long)PyFloat_AsDouble(py_slice_height);
+        if (PyErr_Occurred())
+            goto done;
+
+        long cy;
+        for (cy = 1; cy < height - 1; ++cy)
+        {
+            char head = KEY(cx, cy - 1);
+            char feet = KEY(cx, cy);
+            char floor = KEY(cx, cy + 1);
+            if (!feet || !head || key_is_solid(feet) || key_is_solid(head) || !key_is_solid(floor))
+                continue;
+
+            SpawnCandidate *candidate = &candidates[n++];
+            candidate->x = cx;
+            candidate->y = cy;
+
+            // The head is the higher cell, so gets the most daylight.
+            long d_ground = cy - 1 - ground_y;
+            candidate->sky = d_ground < 0 ? 1 : fmax(0, 1 - (float)d_ground / GROUND_FADE);
+
+            candidate->light = 0;
+            long lx, ly;
+            for (lx = cx - max_radius; lx <= cx + max_radius; ++lx)
+            {
+                for (ly = cy - 1 - max_radius; ly <= cy + max_radius; ++ly)
+                {
+                    if (ly < 0 || ly >= height)
+                        continue;
+
+                    char key = KEY(lx, ly);
+                    if (key <= 0 || !light_radius[(int)key])
+                        continue;
+
+                    long dy;
+                    for (dy = -1; dy <= 0; ++dy)
+                    {
+                        float distance = circle_dist(cx, cy + dy, lx, ly, light_radius[(int)key]);
+                        if (distance < 1)
+                        {
+                            float lightness = 1 - distance * light_lightness[(int)key];
+                            if (lightness > candidate->light)
+                                candidate->light = lightness;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    #undef KEY
+
+    result = PyBytes_FromStringAndSize((const char *)candidates, n * sizeof(SpawnCandidate));
+
+done:
+    free(keys);
+    free(candidates);
+    return result;
+}
+
+
+static PyObject *
+sample_spawns(PyObject *self, PyObject *args)
+{
+    PyObject *py_chunks_arg, *py_player_xs_arg;
+    long x_min, x_max, y_min, y_max, min_player_distance, n;
+    double day, max_light;
+    unsigned long long seed;
+
+    if (!PyArg_ParseTuple(args, "OllllddOllK:sample_spawns", &py_chunks_arg, &x_min, &x_max, &y_min, &y_max, &day, &max_light, &py_player_xs_arg, &min_player_distance, &n, &seed))
+        return NULL;
+
+    if (n <= 0)
+        return PyList_New(0);
+
+    PyObject *py_chunks = PySequence_Fast(py_chunks_arg, "chunks must be a sequence");
+    if (!py_chunks)
+        return NULL;
+    PyObject *py_player_xs = PySequence_Fast(py_player_xs_arg, "player_xs must be a sequence");
+    if (!py_player_xs)
+    {
+        Py_DECREF(py_chunks);
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    long n_players = PySequence_Fast_GET_SIZE(py_player_xs);
+    long *player_xs = (long *)malloc((n_players + 1) * sizeof(long));
+    SpawnCandidate **chosen = (SpawnCandidate **)malloc(n * sizeof(SpawnCandidate *));
+    if (!player_xs || !chosen)
+    {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    long i;
+    for (i = 0; i < n_players; ++i)
+    {
+        player_xs[i] = PyLong_AsLong(PySequence_Fast_GET_ITEM(py_player_xs, i));
+        if (PyErr_Occurred())
+            goto done;
+    }
+
+    // Reservoir sampling: each candidate which can spawn a mob is as likely to be chosen, in one pass.
+    uint64_t state = seed;
+    long n_seen = 0;
+
+    long c;
+    for (c = 0; c < PySequence_Fast_GET_SIZE(py_chunks); ++c)
+    {
+        PyObject *py_candidates = PySequence_Fast_GET_ITEM(py_chunks, c);
+        if (!PyBytes_Check(py_candidates))
+        {
+            PyErr_SetString(C_MOBS_EXCEPTION, "chunks must contain bytes from spawn_candidates!");
+            goto done;
+        }
+
+        SpawnCandidate *candidates = (SpawnCandidate *)PyBytes_AS_STRING(py_candidates);
+        long n_candidates = PyBytes_GET_SIZE(py_candidates) / sizeof(SpawnCandidate);
+
+        long j;
+        for (j = 0; j < n_candidates; ++j)
+        {
+            SpawnCandidate *candidate = &candidates[j];
+            if (candidate->x < x_min || candidate->x >= x_max ||
+                candidate->y < y_min || candidate->y >= y_max ||
+                candidate->light >= max_light || day * candidate->sky >= max_light)
+                continue;
+
+            bool near_player = false;
+            for (i = 0; i < n_players && !near_player; ++i)
+            {
+                near_player = labs(player_xs[i] - candidate->x) < min_player_distance;
+            }
+            if (near_player)
+                continue;
+
+            if (n_seen < n)
+            {
+                chosen[n_seen] = candidate;
+            }
+            else
+            {
+                uint64_t k = next_random(&state) % (uint64_t)(n_seen + 1);
+                if (k < (uint64_t)n)
+                    chosen[k] = candidate;
+            }
+            ++n_seen;
+        }
+    }
+
+    long n_chosen = n_seen < n ? n_seen : n;
+    result = PyList_New(n_chosen);
+    if (!result)
+        goto done;
+
+    for (i = 0; i < n_chosen; ++i)
+    {
+        PyObject *spot = Py_BuildValue("(ll)", (long)chosen[i]->x, (long)chosen[i]->y);
+        if (!spot)
+        {
+            Py_CLEAR(result);
+            goto done;
+        }
+        PyList_SET_ITEM(result, i, spot);
+    }
+
+done:
+    free(player_xs);
+    free(chosen);
+    Py_DECREF(py_chunks);
+    Py_DECREF(py_player_xs);
+    return result;
+}
+
+
+static bool
+Store_grow(Store *self)
+{
+    long capacity = self->capacity ? self->capacity * 2 : INITIAL_CAPACITY;
+
+    #define GROW(array, type) \
+        { \
+            type *grown = (type *)realloc(self->array, capacity * sizeof(type)); \
+            if (!grown) \
+            { \
+                PyErr_NoMemory(); \
+                return false; \
+            } \
+            self->array = grown; \
+        }
+
+    GROW(free_slots, long)
+    GROW(alive, char)
+    GROW(x, long)
+    GROW(y, long)
+    GROW(x_vel, double)
+    GROW(health, double)
+    GROW(last_attack, double)
+
+    #undef GROW
+
+    self->capacity = capacity;
+    return true;
+}
+
+
+static bool
+Store_check_slot(Store *self, long slot)
+{
+    if (slot < 0 || slot >= self->n || !self->alive[slot])
+    {
+        PyErr_Format(C_MOBS_EXCEPTION, "No mob in slot %ld!", slot);
+        return false;
+    }
+    return true;
+}
+
+
+static void
+Store_dealloc(Store *self)
+{
+    free(self->free_slots);
+    free(self->alive);
+    free(self->x);
+    free(self->y);
+    free(self->x_vel);
+    free(self->health);
+    free(self->last_attack);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+
+static PyObject *
+Store_add(Store *self, PyObject *args)
+{
+    long x, y;
+    double x_vel, health, last_attack;
+
+    if (!PyArg_ParseTuple(args, "llddd:add", &x, &y, &x_vel, &health, &last_attack))
+        return NULL;
+
+    long slot;
+    if (self->n_free > 0)
+    {
+        slot = self->free_slots[--self->n_free];
+    }
+    else
+    {
+        if (self->n == self->capacity && !Store_grow(self))
+            return NULL;
+        slot = self->n++;
+    }
+
+    self->alive[slot] = true;
+    self->x[slot] = x;
+    self->y[slot] = y;
+    self->x_vel[slot] = x_vel;
+    self->health[slot] = health;
+    self->last_attack[slot] = last_attack;
+
+    return PyLong_FromLong(slot);
+}
+
+
+static PyObject *
+Store_remove(Store *self, PyObject *args)
+{
+    long slot;
+
+    if (!PyArg_ParseTuple(args, "l:remove", &slot) || !Store_check_slot(self, slot))
+        return NULL;
+
+    self->alive[slot] = false;
+    self->free_slots[self->n_free++] = slot;
+
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Store_get(Store *self, PyObject *args)
+{
+    long slot, field;
+
+    if (!PyArg_ParseTuple(args, "ll:get", &slot, &field) || !Store_check_slot(self, slot))
+        return NULL;
+
+    switch (field)
+    {
+        case FIELD_X:
+            return PyLong_FromLong(self->x[slot]);
+        case FIELD_Y:
+            return PyLong_FromLong(self->y[slot]);
+        case FIELD_X_VEL:
+            return PyFloat_FromDouble(self->x_vel[slot]);
+        case FIELD_HEALTH:
+            return PyFloat_FromDouble(self->health[slot]);
+        case FIELD_LAST_ATTACK:
+            return PyFloat_FromDouble(self->last_attack[slot]);
+    }
+
+    PyErr_Format(C_MOBS_EXCEPTION, "No field %ld!", field);
+    return NULL;
+}
+
+
+static PyObject *
+Store_set(Store *self, PyObject *args)
+{
+    long slot, field;
+    PyObject *value;
+
+    if (!PyArg_ParseTuple(args, "llO:set", &slot, &field, &value) || !Store_check_slot(self, slot))
+        return NULL;
+
+    switch (field)
+    {
+        case FIELD_X:
+            self->x[slot] = PyLong_AsLong(value);
+            break;
+        case FIELD_Y:
+            self->y[slot] = PyLong_AsLong(value);
+            break;
+        case FIELD_X_VEL:
+            self->x_vel[slot] = PyFloat_AsDouble(value);
+            break;
+        case FIELD_HEALTH:
+            self->health[slot] = PyFloat_AsDouble(value);
+            break;
+        case FIELD_LAST_ATTACK:
+            self->last_attack[slot] = PyFloat_AsDouble(value);
+            break;
+        default:
+            PyErr_Format(C_MOBS_EXCEPTION, "No field %ld!", field);
+            return NULL;
+    }
+
+    if (PyErr_Occurred())
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Store_step(Store *self, PyObject *args)
+{
+    PyObject *py_players_arg, *py_fields_arg, *map;
+    double last_tick, attack_radius, attack_strength, attack_period;
+
+    if (!PyArg_ParseTuple(args, "OOO!dddd:step", &py_players_arg, &py_fields_arg, &PyDict_Type, &map, &last_tick, &attack_radius, &attack_strength, &attack_period))
+        return NULL;
+
+    PyObject *py_players = PySequence_Fast(py_players_arg, "players must be a sequence");
+    if (!py_players)
+        return NULL;
+    PyObject *py_fields = PySequence_Fast(py_fields_arg, "fields must be a sequence");
+    if (!py_fields)
+    {
+        Py_DECREF(py_players);
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    PyObject *dead = NULL, *lost = NULL, *py_damage = NULL;
+    double *damage = NULL;
+    Players players = {0};
+
+    if (!players_init(&players, py_players, py_fields))
+        goto done;
+
+    damage = (double *)calloc(players.n + 1, sizeof(double));
+    dead = PyList_New(0);
+    lost = PyList_New(0);
+    if (!damage)
+    {
+        PyErr_NoMemory();
+        goto done;
+    }
+    if (!dead || !lost)
+        goto done;
+
+    long slot;
+    for (slot = 0; slot < self->n; ++slot)
+    {
+        if (!self->alive[slot])
+            continue;
+
+        PyObject *removed_list = NULL;
+
+        if (self->health[slot] <= 0)
+        {
+            removed_list = dead;
+        }
+        else if (players.n > 0)
+        {
+            long closest;
+            long closest_i = closest_player(&players, self->x[slot], &closest);
+
+            if (closest < attack_radius && self->last_attack[slot] + attack_period <= last_tick)
+            {
+                attack_players(&players, self->x[slot], self->y[slot], attack_radius, attack_strength, damage);
+                self->last_attack[slot] = last_tick;
+            }
+            else if (!follow_field(self, slot, &players.fields[closest_i]) &&
+                     !pathfind_towards_delta(self, slot, closest, map))
+            {
+                removed_list = lost;
+            }
+
+            if (PyErr_Occurred())
+                goto done;
+        }
+
+        if (removed_list)
+        {
+            PyObject *py_slot = PyLong_FromLong(slot);
+            if (!py_slot || PyList_Append(removed_list, py_slot) != 0)
+            {
+                Py_XDECREF(py_slot);
+                goto done;
+            }
+            Py_DECREF(py_slot);
+        }
+    }
+
+    py_damage = PyList_New(players.n);
+    if (!py_damage)
+        goto done;
+
+    long i;
+    for (i = 0; i < players.n; ++i)
+    {
+        PyObject *py_player_damage = PyFloat_FromDouble(damage[i]);
+        if (!py_player_damage)
+            goto done;
+        PyList_SET_ITEM(py_damage, i, py_player_damage);
+    }
+
+    result = Py_BuildValue("OOO", dead, lost, py_damage);
+
+done:
+    players_free(&players);
+    free(damage);
+    Py_XDECREF(dead);
+    Py_XDECREF(lost);
+    Py_XDECREF(py_damage);
+    Py_DECREF(py_players);
+    Py_DECREF(py_fields);
+    return result;
+}
+
+
+static PyMethodDef Store_methods[] = {
+    {"add", (PyCFunction)Store_add, METH_VARARGS, PyDoc_STR("add(x, y, x_vel, health, last_attack) -> slot")},
+    {"remove", (PyCFunction)Store_remove, METH_VARARGS, PyDoc_STR("remove(slot), the slot is reused by a later add")},
+    {"get", (PyCFunction)Store_get, METH_VARARGS, PyDoc_STR("get(slot, field) -> value")},
+    {"set", (PyCFunction)Store_set, METH_VARARGS, PyDoc_STR("set(slot, field, value)")},
+    {"step", (PyCFunction)Store_step, METH_VARARGS, PyDoc_STR("step(players, fields, map, last_tick, attack_radius, attack_strength, attack_period) -> (dead slots, lost slots, damage to each player)")},
+    {NULL, NULL}  /* sentinel */
+};
+
+static PyTypeObject StoreType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mobs_c.Store",
+    .tp_doc = PyDoc_STR("Mobs, kept a field to an array"),
+    .tp_basicsize = sizeof(Store),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor)Store_dealloc,
+    .tp_methods = Store_methods,
+};
+
+
+PyDoc_STRVAR(module_doc, "Bulk mob updates");
+
+static PyMethodDef mobs_c_methods[] = {
+    {"flow_field", flow_field, METH_VARARGS, PyDoc_STR("flow_field(map, x, y, width, height, target_x, target_y) -> bytes, the step from each cell towards the target")},
+    {"spawn_candidates", spawn_candidates, METH_VARARGS, PyDoc_STR("spawn_candidates(map, slice_heights, x, width, light_blocks) -> bytes, the cells in the columns a mob could spawn in")},
+    {"sample_spawns", sample_spawns, METH_VARARGS, PyDoc_STR("sample_spawns(chunks, x_min, x_max, y_min, y_max, day, max_light, player_xs, min_player_distance, n, seed) -> [(x, y), ...], up to n spawn_candidates dark enough and away from the players")},
+    {NULL, NULL}  /* sentinel */
+};
+
+static struct PyModuleDef mobs_c_module = {
+    PyModuleDef_HEAD_INIT,
+    "mobs_c",
+    module_doc,
+    -1,
+    mobs_c_methods,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+PyMODINIT_FUNC
+PyInit_mobs_c(void)
+{
+    PyObject *m = NULL;
+
+    if (PyType_Ready(&StoreType) < 0)
+        return NULL;
+
+    // Create the module and add the types
+    m = PyModule_Create(&mobs_c_module);
+    if (m == NULL)
+        return NULL;
+
+    Py_INCREF(&StoreType);
+    if (PyModule_AddObject(m, "Store", (PyObject *)&StoreType) < 0)
+    {
+        Py_DECREF(&StoreType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    C_MOBS_EXCEPTION = PyErr_NewException("mobs_c.MobsException", NULL, NULL);
+
+    return m;
+}
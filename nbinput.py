@@ -3,6 +3,7 @@ Most of this code came from this page:
 http://code.activestate.com/recipes/134892/#c5
 """
 
+import os
 import sys
 import select
 
@@ -30,6 +31,10 @@ class NonBlockingInput:
         except:
             return None
 
+    def fileno(self):
+        """ The file to wait on for input, or None if it can't be waited on. """
+        return self.impl.fileno()
+
     def __enter__(self):
         self.impl.enter()
         return self
@@ -60,9 +65,13 @@ class _nbiGetchUnix:
         self.termios.tcsetattr(sys.stdin,
             self.termios.TCSADRAIN, self.old_settings)
 
+    def fileno(self):
+        return sys.stdin.fileno()
+
     def char(self):
         if select.select([sys.stdin], [], [], 0) == ([sys.stdin], [], []):
-            return sys.stdin.read(1)
+            # Read unbuffered, so select() sees any characters which are left.
+            return os.read(sys.stdin.fileno(), 1).decode()
         return None
 
 
@@ -77,6 +86,9 @@ class _nbiGetchWindows:
     def exit(self, type_, value, traceback):
         pass
 
+    def fileno(self):
+        return None
+
     def char(self):
         if self.msvcrt.kbhit():
             try:
@@ -105,6 +117,9 @@ class _nbiGetchMacCarbon:
     def exit(self, type_, value, traceback):
         pass
 
+    def fileno(self):
+        return None
+
     def char(self):
         if self.Carbon.Evt.EventAvail(0x0008)[0] == 0:  # 0x0008 is the keyDownMask
             return ''
@@ -0,0 +1,159 @@
+"""
+Reads the frame buffer written by the C renderer when the neopixels setting
+    is on. Run this in another terminal to mirror the game, or use Reader in
+    something which drives real pixels.
+"""
+
+import mmap
+import os
+import struct
+import sys
+import time
+
+
+MAGIC = 0x42464350
+VERSION = 1
+
+HEADER = struct.Struct('=8I')
+CELL = struct.Struct('=3B3BBBI')
+
+FG_SET = 1
+BG_SET = 2
+HUD = 4
+
+
+class Reader:
+    """ Maps the frame buffer file and copies out consistent frames. """
+
+    def __init__(self, path):
+        self._file = open(path, 'rb')
+        self._map = None
+        self._size = 0
+        self.sequence = None
+
+    def close(self):
+        if self._map is not None:
+            self._map.close()
+        self._file.close()
+
+    def _remap(self):
+        # The renderer only ever grows the file, so this is only needed when
+        #   it has been resized.
+        size = os.fstat(self._file.fileno()).st_size
+        if size != self._size:
+            if self._map is not None:
+                self._map.close()
+                self._map = None
+            self._size = size
+            if size >= HEADER.size:
+                self._map = mmap.mmap(self._file.fileno(), size, access=mmap.ACCESS_READ)
+        return self._map
+
+    def read(self, retries=100):
+        """
+            Returns (width, height, map_width, cells) for the latest frame, or
+                None if there is no new frame since the last call.
+
+            cells is a list of rows of (character, fg, bg, style, flags), with
+                fg and bg as (r, g, b) tuples, or None where they are not set.
+        """
+
+        for _ in range(retries):
+            map_ = self._remap()
+            if map_ is None:
+                return None
+
+            magic, version, header_size, cell_size, width, height, sequence, map_width = HEADER.unpack_from(map_)
+            if magic != MAGIC or version != VERSION:
+                return None
+
+            if sequence & 1:
+                time.sleep(0)
+                continue
+            if sequence == self.sequence:
+                return None
+
+            end = header_size + width * height * cell_size
+            if end > len(map_):
+                continue
+            data = map_[header_size:end]
+
+            # The writer started another frame while we were copying this one.
+            if HEADER.unpack_from(map_)[6] != sequence:
+                continue
+
+            self.sequence = sequence
+            return width, height, map_width, self._unpack(data, width, height, cell_size)
+
+        return None
+
+    @staticmethod
+    def _unpack(data, width, height, cell_size):
+        cells = []
+        for y in range(height):
+            row = []
+            for x in range(width):
+                bg_r, bg_g, bg_b, fg_r, fg_g, fg_b, style, flags, char = CELL.unpack_from(data, (y * width + x) * cell_size)
+                row.append((
+                    chr(char) if char else ' ',
+                    (fg_r, fg_g, fg_b) if flags & FG_SET else None,
+                    (bg_r, bg_g, bg_b) if flags & BG_SET else None,
+                    style,
+                    flags
+                ))
+            cells.append(row)
+        return cells
+
+
+def ansi_frame(cells, map_only=False, map_width=None):
+    out = '\033[H'
+    for row in cells:
+        if map_only:
+            row = row[:map_width]
+        for char, fg, bg, style, flags in row:
+            codes = []
+            if bg is not None:
+                codes.append('48;2;{};{};{}'.format(*bg))
+            if fg is not None:
+                codes.append('38;2;{};{};{}'.format(*fg))
+            if style:
+                codes.append(str(style))
+            out += ('\033[' + ';'.join(codes) + 'm' if codes else '') + char + '\033[0m'
+        out += '\n'
+    return out
+
+
+def main():
+    args = [arg for arg in sys.argv[1:] if not arg.startswith('--')]
+    path = args[0] if args else 'neopixels.fb'
+    map_only = '--map' in sys.argv
+
+    reader = Reader(path)
+    print('\033[2J', end='')
+
+    frames = 0
+    last_report = time.time()
+    try:
+        while True:
+            frame = reader.read()
+            if frame is None:
+                time.sleep(1/60)
+                continue
+
+            width, height, map_width, cells = frame
+            frames += 1
+
+            print(ansi_frame(cells, map_only, map_width), end='')
+
+            if time.time() - last_report >= 1:
+                print('\033[2K{}x{} seq {} - {} fps'.format(width, height, reader.sequence, frames), end='', flush=True)
+                frames = 0
+                last_report = time.time()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        reader.close()
+
+
+if __name__ == '__main__':
+    main()
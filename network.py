@@ -1,15 +1,70 @@
+"""
+Messages are {'event': str, 'args': list}, sent as a '!IB' header of the
+    payload's length and type, then the payload.
+
+Chunks, block edits, mob states and entity deltas have their own binary
+    payloads, so the bulk of the traffic skips JSON. Any other message, or one which doesn't
+    fit its binary payload, is sent as JSON.
+
+Sending only queues the message: a sender thread writes each socket's queue
+    as it becomes writable, so one slow client can't hold up the others. A
+    message being sent to many clients is framed once, with frame().
+"""
+
 import socket
 import threading
+import selectors
 import socketserver
 import struct
 import json
-import os
+from time import time, sleep
+from collections import deque
 
 from console import log
-import time
 
 
-SendLock = threading.Lock()
+HEADER = struct.Struct('!IB')
+
+MSG_JSON = 0
+MSG_CHUNKS = 1
+MSG_BLOCKS = 2
+MSG_MOBS = 3
+MSG_DELTA = 4
+
+COUNT = struct.Struct('!I')
+# x, slice height, length of the slice, then the slice's blocks
+CHUNK_SLICE = struct.Struct('!qHH')
+# x, y, block
+BLOCK = struct.Struct('!qHc')
+# x, y, x_vel, health, last_attack, then the id and type as short strings
+MOB = struct.Struct('!qqddd')
+MOB_KEYS = {'x', 'y', 'x_vel', 'health', 'last_attack', 'type'}
+# sequence number, last movement input applied, whether it replaces everything, and the number of kinds
+DELTA = struct.Struct('!IIBB')
+# Entity fields with their own place in a delta, each with a bit in the entity's field mask.
+#   Positions are whole blocks. Any other fields follow as JSON.
+DELTA_FIELDS = (('x', struct.Struct('!i')), ('y', struct.Struct('!i')), ('x_vel', struct.Struct('!d')),
+                ('health', struct.Struct('!d')), ('last_attack', struct.Struct('!d')))
+DELTA_INTS = {'x', 'y'}
+DELTA_BITS = {field: bit for bit, (field, _) in enumerate(DELTA_FIELDS)}
+DELTA_EXTRA = 0x80
+
+# Messages which are replaced by the next one, so can be skipped by a client which is behind.
+DROPPABLE = {'entity_delta', 'set_time'}
+
+# Bytes queued for a client before DROPPABLE messages are skipped, and before it is disconnected.
+DROP_QUEUE_SIZE = 256 * 1024
+MAX_QUEUE_SIZE = 8 * 1024 * 1024
+
+# Windows has no MSG_DONTWAIT. There, sockets are only written to once the
+#   selector says they are writable, a SEND_SIZE piece at a time.
+SEND_FLAGS = getattr(socket, 'MSG_DONTWAIT', 0)
+SEND_SIZE = 16 * 1024
+
+# The largest payload accepted, as no bigger message can be queued to be sent.
+MAX_MESSAGE_SIZE = MAX_QUEUE_SIZE
+
+_buffers = threading.local()
 
 
 class ThreadedTCPServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
@@ -22,61 +77,427 @@ def connect(ip, port):
     return sock
 
 
-def send(sock, data):
-    with SendLock:
+def _pack_str(s):
+    data = s.encode('ascii')
+    return bytes((len(data),)) + data
+
+
+def _unpack_str(payload, offset):
+    length = payload[offset]
+    return str(payload[offset + 1:offset + 1 + length], 'ascii'), offset + 1 + length
+
+
+def _encode_chunks(slices, slice_heights):
+    parts = [COUNT.pack(len(slices))]
+    for x, slice_ in slices.items():
+        slice_ = ''.join(slice_).encode('ascii')
+        parts.append(CHUNK_SLICE.pack(int(x), int(slice_heights[x]), len(slice_)))
+        parts.append(slice_)
+    return b''.join(parts)
+
+
+def _decode_chunks(payload):
+    slices = {}
+    slice_heights = {}
+
+    n_slices, = COUNT.unpack_from(payload)
+    offset = COUNT.size
+    for _ in range(n_slices):
+        x, height, length = CHUNK_SLICE.unpack_from(payload, offset)
+        offset += CHUNK_SLICE.size
+
+        slices[x] = str(payload[offset:offset + length], 'ascii')
+        slice_heights[x] = height
+        offset += length
+
+    return [slices, slice_heights]
+
+
+def _encode_blocks(blocks):
+    records = [BLOCK.pack(int(x), int(y), block.encode('ascii'))
+               for x, col in blocks.items() for y, block in col.items()]
+    return COUNT.pack(len(records)) + b''.join(records)
+
+
+def _decode_blocks(payload):
+    blocks = {}
+
+    n_blocks, = COUNT.unpack_from(payload)
+    for x, y, block in BLOCK.iter_unpack(payload[COUNT.size:COUNT.size + n_blocks * BLOCK.size]):
+        blocks.setdefault(x, {})[y] = str(block, 'ascii')
+
+    return [blocks]
+
+
+def _encode_mobs(mobs):
+    parts = [COUNT.pack(len(mobs))]
+    for id_, mob in mobs.items():
+        if mob.keys() != MOB_KEYS or not (isinstance(mob['x'], int) and isinstance(mob['y'], int)):
+            return None
+
+        parts.append(MOB.pack(mob['x'], mob['y'], mob['x_vel'], mob['health'], mob['last_attack']))
+        parts.append(_pack_str(id_))
+        parts.append(_pack_str(mob['type']))
+    return b''.join(parts)
+
+
+def _decode_mobs(payload):
+    mobs = {}
+
+    n_mobs, = COUNT.unpack_from(payload)
+    offset = COUNT.size
+    for _ in range(n_mobs):
+        x, y, x_vel, health, last_attack = MOB.unpack_from(payload, offset)
+        offset += MOB.size
+        id_, offset = _unpack_str(payload, offset)
+        type_, offset = _unpack_str(payload, offset)
+
+        mobs[id_] = {'x': x, 'y': y, 'x_vel': x_vel, 'health': health, 'last_attack': last_attack, 'type': type_}
+
+    return [mobs]
+
+
+def _delta_field(field, value):
+    if isinstance(value, bool):
+        return False
+    return isinstance(value, int) if field in DELTA_INTS else isinstance(value, (int, float))
+
+
+def _encode_delta(seq, ack, full, changes, removed):
+    parts = [DELTA.pack(seq, ack, full, len(changes.keys() | removed.keys()))]
+
+    for kind in changes.keys() | removed.keys():
+        parts.append(_pack_str(kind))
+
+        entities = changes.get(kind, {})
+        parts.append(COUNT.pack(len(entities)))
+        for id_, fields in entities.items():
+            mask = 0
+            values = []
+            for bit, (field, field_struct) in enumerate(DELTA_FIELDS):
+                if field in fields and _delta_field(field, fields[field]):
+                    mask |= 1 << bit
+                    values.append(field_struct.pack(fields[field]))
+
+            extra = {field: value for field, value in fields.items()
+                     if field not in DELTA_BITS or not mask & (1 << DELTA_BITS[field])}
+            if extra:
+                mask |= DELTA_EXTRA
+                extra = bytes(json.dumps(extra, separators=(',', ':')), 'ascii')
+                values.append(COUNT.pack(len(extra)) + extra)
+
+            parts.append(_pack_str(id_) + bytes((mask,)) + b''.join(values))
+
+        ids = removed.get(kind, [])
+        parts.append(COUNT.pack(len(ids)))
+        parts.extend(_pack_str(id_) for id_ in ids)
+
+    return b''.join(parts)
+
+
+def _decode_delta(payload):
+    changes = {}
+    removed = {}
+
+    seq, ack, full, n_kinds = DELTA.unpack_from(payload)
+    offset = DELTA.size
+    for _ in range(n_kinds):
+        kind, offset = _unpack_str(payload, offset)
+
+        n_entities, = COUNT.unpack_from(payload, offset)
+        offset += COUNT.size
+        for _ in range(n_entities):
+            id_, offset = _unpack_str(payload, offset)
+            mask = payload[offset]
+            offset += 1
+
+            fields = {}
+            for bit, (field, field_struct) in enumerate(DELTA_FIELDS):
+                if mask & (1 << bit):
+                    fields[field], = field_struct.unpack_from(payload, offset)
+                    offset += field_struct.size
+
+            if mask & DELTA_EXTRA:
+                length, = COUNT.unpack_from(payload, offset)
+                offset += COUNT.size
+                fields.update(json.loads(str(payload[offset:offset + length], 'ascii')))
+                offset += length
+
+            changes.setdefault(kind, {})[id_] = fields
+
+        n_removed, = COUNT.unpack_from(payload, offset)
+        offset += COUNT.size
+        for _ in range(n_removed):
+            id_, offset = _unpack_str(payload, offset)
+            removed.setdefault(kind, []).append(id_)
+
+    return [seq, ack, bool(full), changes, removed]
+
+
+# event: (message type, encoder taking the args, decoder returning the args)
+PAYLOADS = {
+    'set_chunks': (MSG_CHUNKS, _encode_chunks, _decode_chunks),
+    'set_blocks': (MSG_BLOCKS, _encode_blocks, _decode_blocks),
+    'set_mobs': (MSG_MOBS, _encode_mobs, _decode_mobs),
+    'entity_delta': (MSG_DELTA, _encode_delta, _decode_delta),
+}
+EVENTS = {msg_type: (event, decode) for event, (msg_type, _, decode) in PAYLOADS.items()}
+
+
+def encode(data):
+    """ Returns (message type, payload) for a message. """
+
+    if data['event'] in PAYLOADS:
+        msg_type, encode_args, _ = PAYLOADS[data['event']]
         try:
-            data = bytes(json.dumps(data), 'ascii')
-            log('sending data length', len(data))
-            header = struct.pack('I', len(data))
-            sock.sendall(header + data)
-        except OSError:
-            log('Socket closing')
-            sock.close()
+            payload = encode_args(*data['args'])
+        except (UnicodeEncodeError, struct.error, TypeError, ValueError, KeyError):
+            payload = None
 
+        if payload is not None:
+            return msg_type, payload
 
-def receive(sock):
-    data = None
-    error = False
-    bufsize = 1024
+    return MSG_JSON, bytes(json.dumps(data, default=dict), 'ascii')
+
+
+def decode(msg_type, payload):
+    if msg_type == MSG_JSON:
+        return json.loads(str(payload, 'ascii'))
+
+    event, decode_args = EVENTS[msg_type]
+    return {'event': event, 'args': decode_args(payload)}
 
-    try:
-        d = sock.recv(4)
-    except OSError:
-        error = True
-    else:
-        if not d:
-            error = True
 
-    if not error:
-        length = struct.unpack('I', d)[0]
-        log('data length', length)
-        d = bytes()
+class Frame(bytes):
+    """ An encoded message, ready to be queued for any number of sockets. """
+    droppable = False
 
+
+def frame(data):
+    msg_type, payload = encode(data)
+
+    result = Frame(HEADER.pack(len(payload), msg_type) + payload)
+    result.droppable = data['event'] in DROPPABLE
+    return result
+
+
+class Sender:
+    """ Writes queued frames to each socket from one thread, as the sockets become writable. """
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._queues = {}
+        self._queue_sizes = {}
+
+        self._selector = selectors.DefaultSelector()
+        self._registered = set()
+
+        self._wake_r, self._wake_w = socket.socketpair()
+        self._wake_r.setblocking(False)
+        self._wake_w.setblocking(False)
+        self._selector.register(self._wake_r, selectors.EVENT_READ)
+
+        self._thread = threading.Thread(target=self._run, daemon=True)
+        self._thread.start()
+
+    def queue(self, sock, frame_):
+        with self._lock:
+            queue = self._queues.setdefault(sock, deque())
+            size = self._queue_sizes.get(sock, 0)
+
+            if frame_.droppable and size > DROP_QUEUE_SIZE:
+                log('Dropping', len(frame_), 'bytes for a slow client')
+                return
+
+            if size + len(frame_) > MAX_QUEUE_SIZE:
+                log('Disconnecting a client which is too far behind')
+                self._disconnect(sock)
+                return
+
+            queue.append(memoryview(frame_))
+            self._queue_sizes[sock] = size + len(frame_)
+
+        try:
+            self._wake_w.send(b'\0')
+        except BlockingIOError:
+            # Already woken
+            pass
+
+    def flush(self, sock, timeout):
+        """ Waits up to timeout seconds for the socket's queue to be sent. """
+
+        end = time() + timeout
+        while time() < end:
+            with self._lock:
+                if sock not in self._queues:
+                    return
+            sleep(0.01)
+
+    def _disconnect(self, sock):
+        """ Drops the socket's queue and shuts it down, which ends its receiving thread. Hold _lock. """
+
+        self._queues.pop(sock, None)
+        self._queue_sizes.pop(sock, None)
         try:
-            for i in range(length // bufsize):
-                d += sock.recv(bufsize)
-                time.sleep(0.001)
-            d += sock.recv(length % bufsize)
+            sock.shutdown(socket.SHUT_RDWR)
         except OSError:
-            error = True
-        else:
-            if not len(d):
-                error = True
+            pass
+
+    def _write(self, sock):
+        """ Sends as much of the socket's queue as it will take without blocking. """
+
+        with self._lock:
+            queue = self._queues.get(sock)
+
+            while queue:
+                view = queue[0]
+                try:
+                    sent = sock.send(view if SEND_FLAGS else view[:SEND_SIZE], SEND_FLAGS)
+                except (BlockingIOError, InterruptedError):
+                    break
+                except OSError:
+                    log('Socket closing')
+                    self._disconnect(sock)
+                    return False
+
+                self._queue_sizes[sock] -= sent
+                if sent == len(view):
+                    queue.popleft()
+                else:
+                    queue[0] = view[sent:]
+
+                # Without MSG_DONTWAIT another send could block, so wait to be writable again.
+                if not SEND_FLAGS:
+                    break
+
+            if sock in self._queues and not queue:
+                del self._queues[sock]
+                del self._queue_sizes[sock]
+
+            return bool(queue)
+
+    def _run(self):
+        while True:
+            for key, _ in self._selector.select():
+                if key.fileobj is self._wake_r:
+                    try:
+                        while self._wake_r.recv(4096):
+                            pass
+                    except BlockingIOError:
+                        pass
+
+            with self._lock:
+                socks = list(self._queues.keys() | self._registered)
+
+            for sock in socks:
+                try:
+                    self._update(sock)
+                except Exception as e:
+                    # One bad socket mustn't stop the others being sent to.
+                    log('Sender error:', repr(e))
+                    with self._lock:
+                        self._disconnect(sock)
+                    self._unregister(sock)
+
+    def _update(self, sock):
+        """ Writes to the socket, and waits for it to be writable only while it still has something to send. """
 
-        if not error:
-            data = str(d, 'ascii')
-            log('real length', len(d))
+        pending = self._write(sock)
 
-    if error:
-        log('Socket closing')
-        sock.close()
+        if pending and sock not in self._registered:
+            try:
+                self._selector.register(sock, selectors.EVENT_WRITE)
+                self._registered.add(sock)
+            except (ValueError, OSError):
+                with self._lock:
+                    self._disconnect(sock)
+        elif not pending and sock in self._registered:
+            self._unregister(sock)
 
-    else:
-        log('Received:', repr(data), trunc=False)
+    def _unregister(self, sock):
         try:
-            return json.loads(data)
-        except ValueError as e:
-            log('JSON Error:', e)
+            self._selector.unregister(sock)
+        except (ValueError, KeyError, OSError):
+            pass
+        self._registered.discard(sock)
+
+
+_sender = None
+_sender_lock = threading.Lock()
+
+
+def send_frame(sock, frame_):
+    global _sender
+
+    with _sender_lock:
+        if _sender is None:
+            _sender = Sender()
+
+    _sender.queue(sock, frame_)
+
+
+def send(sock, data):
+    send_frame(sock, frame(data))
+
+
+def close(sock, timeout=1):
+    """ Closes a socket once its queue has been sent, waking any thread receiving from it. """
+
+    if _sender is not None:
+        _sender.flush(sock, timeout)
+
+    try:
+        sock.shutdown(socket.SHUT_RDWR)
+    except OSError:
+        pass
+    sock.close()
+
+
+def _recv_exactly(sock, view):
+    """ Fills view from the socket, returning False if it closes first. """
+
+    received = 0
+    while received < len(view):
+        n = sock.recv_into(view[received:])
+        if n == 0:
+            return False
+        received += n
+    return True
+
+
+def _buffer(size):
+    """ This thread's receive buffer, grown to at least size bytes. """
+
+    buffer = getattr(_buffers, 'buffer', None)
+    if buffer is None or len(buffer) < size:
+        buffer = _buffers.buffer = bytearray(max(size, 64 * 1024))
+    return buffer
+
+
+def receive(sock):
+    try:
+        header = memoryview(_buffer(HEADER.size))[:HEADER.size]
+        if _recv_exactly(sock, header):
+            length, msg_type = HEADER.unpack(header)
+            log('data length', length)
+
+            if length > MAX_MESSAGE_SIZE:
+                log('Message too large:', length)
+                sock.close()
+                return None
+
+            payload = memoryview(_buffer(length))[:length]
+            if _recv_exactly(sock, payload):
+                try:
+                    return decode(msg_type, payload)
+                except (ValueError, KeyError, IndexError, struct.error) as e:
+                    log('Decoding error:', e)
+                    return None
+    except OSError:
+        pass
+
+    log('Socket closing')
+    sock.close()
 
 
 def requestHandlerFactory(data_handler):
@@ -86,18 +507,21 @@ def requestHandlerFactory(data_handler):
             super().__init__(*args)
 
         def handle(self):
-            while True:
-                data = receive(self.request)
-
-                if data:
-                    response = self.data_handler(self.request, data)
+            try:
+                while True:
+                    data = receive(self.request)
 
-                    if response:
-                        send(self.request, response)
-                else:
-                    break
+                    if data:
+                        response = self.data_handler(self.request, data)
 
-            log('Handler Exiting')
+                        if response:
+                            send(self.request, response)
+                    else:
+                        break
+            finally:
+                # The client may have gone without logging out.
+                self.data_handler(self.request, {'event': 'logout', 'args': []})
+                log('Handler Exiting')
 
     return ThreadedTCPRequestHandler
 
@@ -1,6 +1,178 @@
+"""
+Mobs find their way to players along flow fields.
+
+Each player has a field over the cells near them: for every cell a mob
+    could be in, the step which takes it closest to the player, found
+    breadth first out from the player. A mob then only looks up the cell
+    it is in to know where to go next, however many mobs there are.
+
+Mobs can walk, step up a block, fall, and climb ladders. A field is
+    rebuilt when its player moves to another cell, a block in it changes,
+    or it covers slices which aren't loaded. Mobs outside every field
+    just head for the closest player's x.
+"""
+
 import mobs, terrain, player
 
 
+# How far a field reaches either side of its player, and above and below them.
+FIELD_RADIUS = 48
+FIELD_HEIGHT = 32
+
+# (dx, dy) of each move a mob can make, in the same order as mobs_c.
+MOVES = ((-1, 0), (1, 0), (-1, -1), (1, -1), (0, -1), (0, 1))
+
+# Steps in a field: none, already there, or MOVES[step - STEP_MOVE].
+STEP_NONE = 0
+STEP_ARRIVED = 1
+STEP_MOVE = 2
+
+
+class FlowField:
+    def __init__(self, map_, target):
+        self.target = target
+        self.x = target[0] - FIELD_RADIUS
+        self.y = target[1] - FIELD_HEIGHT
+        self.width = 2 * FIELD_RADIUS + 1
+        self.height = 2 * FIELD_HEIGHT + 1
+
+        self.complete = all(x in map_ for x in range(self.x, self.x + self.width))
+        self.dirty = False
+        self.steps = flow_field(map_, self.x, self.y, self.width, self.height, *target)
+
+    def contains(self, x, y):
+        return self.x <= x < self.x + self.width and self.y <= y < self.y + self.height
+
+    def step(self, x, y):
+        """ Returns the (dx, dy) to move from (x, y) towards the target, or None if the field can't say. """
+
+        if not self.contains(x, y):
+            return None
+
+        step = self.steps[(y - self.y) * self.width + (x - self.x)]
+        if step == STEP_NONE:
+            return None
+        return (0, 0) if step == STEP_ARRIVED else MOVES[step - STEP_MOVE]
+
+    def as_tuple(self):
+        return self.x, self.y, self.width, self.height, self.steps
+
+
+class FlowFields:
+    """ The field of each player. """
+
+    def __init__(self):
+        self._fields = {}
+
+    def update(self, players, map_):
+        """ Rebuilds the fields which are out of date. """
+
+        for name in list(self._fields.keys()):
+            if name not in players:
+                del self._fields[name]
+
+        for name, player_ in players.items():
+            target = int(player_['x']), int(player_['y'])
+            field = self._fields.get(name)
+
+            if target[0] not in map_:
+                self._fields[name] = None
+            elif field is None or field.dirty or not field.complete or field.target != target:
+                self._fields[name] = FlowField(map_, target)
+
+    def blocks_changed(self, blocks):
+        """ Marks the fields holding any of blocks, {x: {y: block}}, to be rebuilt. """
+
+        # Blocks are set by the network threads, while update may be adding fields.
+        for field in list(self._fields.values()):
+            if field is not None and not field.dirty:
+                field.dirty = any(field.contains(int(x), int(y)) for x, col in blocks.items() for y in col)
+
+    def get(self, name):
+        return self._fields.get(name)
+
+
+def flow_field(map_, x, y, width, height, target_x, target_y):
+    """ Uses mobs_c if it is available. """
+
+    if mobs.mobs_c is not None:
+        return mobs.mobs_c.flow_field(map_, x, y, width, height, target_x, target_y)
+    return flow_field_py(map_, x, y, width, height, target_x, target_y)
+
+
+def flow_field_py(map_, x, y, width, height, target_x, target_y):
+    """ The Python flow field, and the reference for mobs_c.flow_field. Returns the step from each cell, row by row. """
+
+    def solid(i, j):
+        if not (0 <= i < width and 0 <= j < height):
+            return True
+        column = map_.get(x + i)
+        return column is None or not (0 <= y + j < len(column)) or terrain.is_solid(column[y + j])
+
+    def ladder(i, j):
+        return not solid(i, j) and map_[x + i][y + j] == '='
+
+    steps = bytearray(width * height)
+    queue = []
+
+    target_i, target_j = target_x - x, target_y - y
+    if 0 <= target_i < width and 0 <= target_j < height:
+        steps[target_j * width + target_i] = STEP_ARRIVED
+        queue.append((target_i, target_j))
+
+    for i, j in queue:
+        for move, (dx, dy) in enumerate(MOVES):
+            from_i, from_j = i - dx, j - dy
+            if not (0 <= from_i < width and 0 <= from_j < height):
+                continue
+
+            if steps[from_j * width + from_i] == STEP_NONE and can_move(solid, ladder, from_i, from_j, dx, dy):
+                steps[from_j * width + from_i] = STEP_MOVE + move
+                queue.append((from_i, from_j))
+
+    return bytes(steps)
+
+
+def can_move(solid, ladder, i, j, dx, dy):
+    """ Whether a mob at (i, j) can move by (dx, dy) in a tick. """
+
+    open_ = lambda i, j: not solid(i, j) and not solid(i, j - 1)
+
+    if not open_(i, j):
+        return False
+
+    # Falling is all a mob can do with nothing to stand on.
+    if not solid(i, j + 1) and not ladder(i, j):
+        return (dx, dy) == (0, 1)
+
+    if dx != 0 and dy == 0:
+        return open_(i + dx, j)
+
+    # Stepping up, like player.get_pos_delta
+    if dx != 0:
+        return solid(i + dx, j) and open_(i + dx, j - 1) and not solid(i, j - 2)
+
+    # Climbing up or down a ladder
+    if dy == -1:
+        return ladder(i, j) and open_(i, j - 1)
+    return ladder(i, j + 1) and open_(i, j + 1)
+
+
+def follow_field(entity, field):
+    """ Moves the entity a step along the field, returning False if the field has no step for it. """
+
+    step = field.step(entity['x'], entity['y']) if field is not None else None
+    if step is None:
+        return False
+
+    dx, dy = step
+    if dx or dy:
+        entity['x'] += dx
+        entity['y'] += dy
+        entity['x_vel'] = dx
+    return True
+
+
 def pathfind_towards_delta(entity, delta, map_):
   updated = False
   kill_entity = False
@@ -0,0 +1,296 @@
+"""
+Binary region files, each holding REGION_SIZE chunks.
+
+Layout, little-endian:
+    header   magic 'PCRG', version, chunk_size, height, REGION_SIZE (u32s)
+    table    REGION_SIZE entries of u32 offset, length and capacity of each
+             chunk's record, with an offset of 0 if it hasn't been saved
+    records  run-length encoded chunks, see rle.encode_chunk
+
+A record is rewritten in place if it still fits in its capacity, otherwise
+    it is moved to the first free space it fits in, or the end of the file.
+    Capacities are rounded up to RECORD_BLOCK, so records can grow a little
+    before moving. The space between records is found again when a file is
+    opened. Files are grown in steps of GROW_SIZE and stay mapped for as
+    long as they are open.
+
+Version 1 files, which stored every block in fixed-size records, are
+    converted when they are opened.
+
+Run on its own to convert the .chunk files in a save into region files:
+
+    python3 region.py <save> [--delete]
+"""
+
+import os
+import sys
+import mmap
+import struct
+from threading import RLock
+
+import rle
+
+
+MAGIC = b'PCRG'
+VERSION = 2
+REGION_SIZE = 32
+REGION_EXT = '.region'
+GROW_SIZE = 64 * 1024
+RECORD_BLOCK = 512
+
+HEADER = struct.Struct('<4s4I')
+ENTRY = struct.Struct('<3I')
+TABLE_SIZE = REGION_SIZE * ENTRY.size
+
+
+def region_num(chunk_n):
+    return chunk_n // REGION_SIZE
+
+
+def _read_v1(path, chunk_size, height):
+    """ Returns {slot: (columns, slice_heights)} from a version 1 region file. """
+
+    blocks_size = chunk_size * height
+    record_size = blocks_size + chunk_size * 2
+
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    chunks = {}
+    for slot in range(REGION_SIZE):
+        offset = struct.unpack_from('<I', data, HEADER.size + slot * 4)[0]
+        if offset:
+            blocks = data[offset:offset + blocks_size].decode('ascii')
+            columns = [rle.RLEColumn.from_slice(blocks[x * height:(x + 1) * height]) for x in range(chunk_size)]
+            slice_heights = list(struct.unpack_from('<{}H'.format(chunk_size), data, offset + blocks_size))
+            chunks[slot] = columns, slice_heights
+
+    return chunks
+
+
+class Region:
+    """ A memory-mapped region file. Hold `lock` around a read-modify-write. """
+
+    def __init__(self, path, chunk_size, height):
+        self.lock = RLock()
+        self.chunk_size = chunk_size
+        self.height = height
+
+        if os.path.isfile(path):
+            with open(path, 'rb') as f:
+                magic, version, file_chunk_size, file_height, file_region_size = HEADER.unpack(f.read(HEADER.size))
+
+            if ((magic, file_chunk_size, file_height, file_region_size) !=
+                    (MAGIC, chunk_size, height, REGION_SIZE) or version not in (1, VERSION)):
+                raise ValueError('Incompatible region file: ' + path)
+
+            if version == 1:
+                self._convert_v1(path)
+
+        new = not os.path.isfile(path)
+        self._file = open(path, 'w+b' if new else 'r+b')
+
+        if new:
+            self._file.write(HEADER.pack(MAGIC, VERSION, chunk_size, height, REGION_SIZE))
+            self._file.truncate(HEADER.size + TABLE_SIZE + GROW_SIZE)
+            self._file.flush()
+
+        self._map = mmap.mmap(self._file.fileno(), 0)
+
+        # (offset, size) of the gaps left by records which have moved, in offset order.
+        self._free = []
+        self._end = HEADER.size + TABLE_SIZE
+        for offset, capacity in sorted((offset, capacity) for offset, _, capacity in map(self._entry, range(REGION_SIZE)) if offset):
+            if offset > self._end:
+                self._free.append((self._end, offset - self._end))
+            self._end = max(self._end, offset + capacity)
+
+    def _convert_v1(self, path):
+        """ Rewrites a version 1 file as the current version, replacing it only once it's complete. """
+
+        tmp_path = path + '.tmp'
+        if os.path.isfile(tmp_path):
+            os.remove(tmp_path)
+
+        new_region = Region(tmp_path, self.chunk_size, self.height)
+        for slot, (columns, slice_heights) in _read_v1(path, self.chunk_size, self.height).items():
+            new_region._write_record(slot, rle.encode_chunk(columns, slice_heights))
+        new_region.close()
+
+        os.replace(tmp_path, path)
+
+    def close(self):
+        with self.lock:
+            try:
+                self._map.close()
+            except BufferError:
+                # Someone still has a view of it, it'll be unmapped when that goes.
+                pass
+            self._file.close()
+
+    def _slot(self, chunk_n):
+        return chunk_n % REGION_SIZE
+
+    def _entry(self, slot):
+        return ENTRY.unpack_from(self._map, HEADER.size + slot * ENTRY.size)
+
+    def has(self, chunk_n):
+        return self._entry(self._slot(chunk_n))[0] != 0
+
+    def read(self, chunk_n):
+        """
+            Returns a memoryview of the chunk's encoded record in the file, or
+                None if it hasn't been saved. It is only valid until the chunk
+                is next written.
+        """
+
+        offset, length, _ = self._entry(self._slot(chunk_n))
+        if not offset:
+            return None
+
+        return memoryview(self._map)[offset:offset + length]
+
+    def read_chunk(self, chunk_n):
+        """ Returns (columns, slice_heights), lists of RLEColumns and ints in x order, or None. """
+
+        with self.lock:
+            record = self.read(chunk_n)
+            if record is None:
+                return None
+
+            try:
+                return rle.decode_chunk(record, self.chunk_size)
+            finally:
+                record.release()
+
+    def _grow(self, size):
+        """ Reserves size bytes at the end of the file, and returns their offset. """
+
+        offset = self._end
+        self._end += size
+
+        if self._end > len(self._map):
+            new_size = self._end + GROW_SIZE
+            self._file.truncate(new_size)
+            # Leave the old map for anyone who still has a view of it.
+            self._map = mmap.mmap(self._file.fileno(), new_size)
+
+        return offset
+
+    def _allocate(self, size):
+        """ Returns the offset of size free bytes, from the first gap they fit in or the end of the file. """
+
+        for i, (offset, free_size) in enumerate(self._free):
+            if free_size >= size:
+                if free_size == size:
+                    del self._free[i]
+                else:
+                    self._free[i] = (offset + size, free_size - size)
+                return offset
+
+        return self._grow(size)
+
+    def _release(self, offset, size):
+        """ Adds the space to the free list, merging it with the gaps either side. """
+
+        self._free.append((offset, size))
+        self._free.sort()
+
+        merged = []
+        for offset, size in self._free:
+            if merged and merged[-1][0] + merged[-1][1] == offset:
+                merged[-1] = (merged[-1][0], merged[-1][1] + size)
+            else:
+                merged.append((offset, size))
+
+        # Space at the end is given back to the end.
+        if merged and merged[-1][0] + merged[-1][1] == self._end:
+            self._end = merged.pop()[0]
+
+        self._free = merged
+
+    def _write_record(self, slot, record):
+        old_offset, _, old_capacity = self._entry(slot)
+
+        if old_offset and len(record) <= old_capacity:
+            offset, capacity = old_offset, old_capacity
+        else:
+            capacity = -(-len(record) // RECORD_BLOCK) * RECORD_BLOCK
+            offset = self._allocate(capacity)
+
+        self._map[offset:offset + len(record)] = record
+
+        # Only point to the record once it has been written, and only reuse the old one after.
+        ENTRY.pack_into(self._map, HEADER.size + slot * ENTRY.size, offset, len(record), capacity)
+        if old_offset and offset != old_offset:
+            self._release(old_offset, old_capacity)
+
+    def write(self, chunk_n, chunk, slice_heights):
+        """ Writes the slices in chunk, {x: slice}, into the chunk's record. """
+
+        with self.lock:
+            existing = self.read_chunk(chunk_n)
+            if existing is not None:
+                columns, heights = existing
+            else:
+                # An empty record, in case not every slice is being written.
+                columns = [rle.RLEColumn.from_slice(' ' * self.height)] * self.chunk_size
+                heights = [0] * self.chunk_size
+
+            for x, slice_ in chunk.items():
+                rel_x = int(x) % self.chunk_size
+
+                columns[rel_x] = slice_ if isinstance(slice_, rle.RLEColumn) else rle.RLEColumn.from_slice(slice_)
+                heights[rel_x] = int(slice_heights[x])
+
+            self._write_record(self._slot(chunk_n), rle.encode_chunk(columns, heights))
+
+    def flush(self):
+        self._map.flush()
+
+
+def convert(save, delete=False):
+    """ Copies every .chunk file in the save into region files. """
+
+    import saves
+
+    chunk_files = [f for f in os.listdir(saves.save_path(save)) if f.endswith(saves.CHUNK_EXT)]
+
+    for n, filename in enumerate(chunk_files, 1):
+        chunk_n = int(filename[:-len(saves.CHUNK_EXT)])
+
+        # Chunks already in a region have been written since, so are newer.
+        region_ = saves.get_region(save, chunk_n)
+        if not region_.has(chunk_n):
+            chunk, slice_heights = saves.load_text_chunk(save, chunk_n)
+            if chunk:
+                region_.write(chunk_n, chunk, slice_heights)
+
+        print('\r{}/{}'.format(n, len(chunk_files)), end='', flush=True)
+
+    saves.close_regions()
+
+    if delete:
+        for filename in chunk_files:
+            os.remove(saves.save_path(save, filename))
+
+    print('\nConverted {} chunks'.format(len(chunk_files)))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__.strip().split('\n')[-1].strip())
+        return
+
+    import saves
+
+    save = sys.argv[1]
+    if not os.path.isdir(saves.save_path(save)):
+        print('No save called', save)
+        return
+
+    convert(save, '--delete' in sys.argv)
+
+
+if __name__ == '__main__':
+    main()
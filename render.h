@@ -9,6 +9,7 @@ typedef struct
     bool neopixels_output;
     bool fancy_lights;
     bool colours;
+    long lighting_resolution;
 } Settings;
 
 
@@ -48,9 +49,15 @@ typedef struct {
 } Light;
 
 
+#define MAX_BK_OBJECT_PIXELS 16
+
 typedef struct
 {
     int current_frame;
+
+    // The buffer holds one sample every `scale` pixels in each direction,
+    //   width and height are the number of samples.
+    long scale;
     long width;
     long height;
 
@@ -65,7 +72,18 @@ typedef struct
 
         float lightness;
         int lightness_set_on_frame;
+
+        bool underground;
     } *screen;
+
+    // Background objects are kept at full resolution, so they don't get blurred.
+    int n_bk_object_pixels;
+    struct BkObjectPixel
+    {
+        long x;
+        long y;
+        Colour colour;
+    } bk_object_pixels[MAX_BK_OBJECT_PIXELS];
 } LightingBuffer;
 
 
@@ -114,3 +132,46 @@ typedef struct
     Object objects[OBJECTS_MAP_SIZE];
 } ObjectsMap;
 
+
+
+// Shared-memory frame buffer, written every frame when the neopixels setting
+//   is on. See neopixels.py for a reader. Fields are in the host's byte order.
+#define FRAMEBUFFER_MAGIC 0x42464350  // "PCFB"
+#define FRAMEBUFFER_VERSION 1
+
+#define FRAMEBUFFER_FG_SET 1
+#define FRAMEBUFFER_BG_SET 2
+#define FRAMEBUFFER_HUD 4
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t cell_size;
+    uint32_t width;
+    uint32_t height;
+    // Odd while a frame is being written, readers should retry if it is odd
+    //   or has changed by the time they have finished copying the cells.
+    uint32_t sequence;
+    uint32_t map_width;
+} FramebufferHeader;
+
+typedef struct
+{
+    uint8_t bg[3];
+    uint8_t fg[3];
+    uint8_t style;
+    uint8_t flags;
+    uint32_t character;
+} FramebufferCell;
+
+
+typedef struct
+{
+    int fd;
+    char path[PATH_MAX];
+    size_t size;
+    FramebufferHeader *header;
+    FramebufferCell *cells;
+} Framebuffer;
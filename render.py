@@ -23,7 +23,7 @@ lit = lambda x, y, p: min(circle_dist(x, y, p['x'], p['y'], p['radius']), 1)
 last_frame = {}
 
 
-def render_map(map_, slice_heights, edges, edges_y, objects, bk_objects, sky_colour, day, lights, settings, redraw_all):
+def render_map(map_, slice_heights, edges, edges_y, objects, hud, bk_objects, sky_colour, day, lights, settings, redraw_all):
     """
         Prints out a frame of the game.
 
@@ -34,6 +34,7 @@ def render_map(map_, slice_heights, edges, edges_y, objects, bk_objects, sky_col
         - edges_y: the range to display in the y axis
         - objects: a list of dictionaries:
             {'x': int, 'y': int, 'char': block}
+        - hud: a list of text boxes to draw over the frame, from layout_hud
         - bk_objects: list of objects to be displayed in the background:
             {'x': int, 'y': int, 'colour': tuple[3], 'light_colour': tuple[3], 'light_radius': tuple[3]}
         - sky_colour: the colour of the sky
@@ -55,6 +56,9 @@ def render_map(map_, slice_heights, edges, edges_y, objects, bk_objects, sky_col
     objects = list(filter(lambda o: (o['x'] >= 0 and o['x'] <= (edges[1] - edges[0])) and
                                     (o['y'] >= edges_y[0] and o['y'] <= edges_y[1]), objects))
 
+    hud_frame = {pos: pixel for pos, pixel in hud_pixels(hud).items()
+                 if pos[1] in range(edges_y[1] - edges_y[0])}
+
     for world_x, column in map_.items():
         if world_x in range(*edges):
 
@@ -69,7 +73,7 @@ def render_map(map_, slice_heights, edges, edges_y, objects, bk_objects, sky_col
                         bk_objects, sky_colour, day, lights, settings.get('fancy_lights'))
 
                     if settings.get('terminal_output'):
-                        pixel = colour_str(
+                        pixel = hud_frame.get((x, y)) or colour_str(
                             char,
                             bg = rgb(*bg) if bg is not None else None,
                             fg = rgb(*fg) if fg is not None else None,
@@ -78,13 +82,19 @@ def render_map(map_, slice_heights, edges, edges_y, objects, bk_objects, sky_col
 
                         this_frame[x, y] = pixel
 
-                        try:
-                            if not last_frame[x, y] == pixel:
-                                # Changed
-                                diff += POS_STR(x, y, pixel)
-                        except KeyError:
-                            # Doesn't exist
-                            diff += POS_STR(x, y, pixel)
+    if settings.get('terminal_output'):
+        # HUD pixels outside of the map
+        for pos, pixel in hud_frame.items():
+            this_frame.setdefault(pos, pixel)
+
+        for (x, y), pixel in this_frame.items():
+            if not last_frame.get((x, y)) == pixel:
+                # Changed or doesn't exist
+                diff += POS_STR(x, y, pixel)
+
+        # Clear pixels which aren't drawn anymore, like parts of a shrinking HUD
+        for x, y in last_frame.keys() - this_frame.keys():
+            diff += POS_STR(x, y, ' ')
 
     last_frame = this_frame
 
@@ -414,6 +424,11 @@ def get_lights(_map, bk_objects, player_x):
 
 
 def render_grid(title, selected, grid, max_height, sel=None):
+    """
+        Returns the rows of an inventory/crafting grid, each row is a
+            list of (text, fg, bg, style) spans.
+    """
+
     h, v, tl, t, tr, l, m, r, bl, b, br = \
         supported_chars('─│╭┬╮├┼┤╰┴╯', '─│┌┬┐├┼┤└┴┘', '-|+++++++++')
 
@@ -440,58 +455,84 @@ def render_grid(title, selected, grid, max_height, sel=None):
     trailing = ' ' * (max_w - len(top))
 
     out = []
-    out.append(bold(title, selected) + ' ' * (max_w - len(title)))
-    out.append(top + trailing)
+    out.append([(title, None, None, BOLD if selected else None),
+                (' ' * (max_w - len(title)), None, None, None)])
+    out.append([(top + trailing, None, None, None)])
 
     for c, slot in enumerate(grid[offset:offset+max_height]):
         i = c + offset
 
-        block_char = blocks[slot['block']]['char']
-        num = slot['num']
-
-        colour = blocks[slot['block']]['colours']
-        block_char = colour_str(
-            block_char,
-            fg=rgb(*colour['fg']) if colour['fg'] is not None else None,
-            bg=rgb(*colour['bg']) if colour['bg'] is not None else None,
-            style=colour['style']
-        )
+        block = blocks[slot['block']]
+        num = '{:{max}}'.format(slot['num'], max=max_n_w)
 
-        # Have to do the padding before colour because the colour
-        #   messes with the char count. (The block will always be 1 char wide.)
-        num = '{:{max}}'.format(num, max=max_n_w)
-
-        out.append('{v} {b} {v} {n} {v}{trail}'.format(
-            b=block_char,
-            n=colour_str(num, bg=rgb(*RED)) if selected and i == sel else num,
-            v=v,
-            trail=trailing
-        ))
+        out.append([
+            (v + ' ', None, None, None),
+            (block['char'], block['colours']['fg'], block['colours']['bg'], block['colours']['style']),
+            (' ' + v + ' ', None, None, None),
+            (num, None, RED if selected and i == sel else None, None),
+            (' ' + v + trailing, None, None, None)
+        ])
 
         if not (c == max_height - 1 or i == len(grid) - 1):
-            out.append(l + (h*3) + m + (h*(max_n_w+2)) + r + trailing)
+            out.append([(l + (h*3) + m + (h*(max_n_w+2)) + r + trailing, None, None, None)])
 
-    out.append(bl + (h*3) + b + (h*(max_n_w+2)) + br + trailing)
+    out.append([(bl + (h*3) + b + (h*(max_n_w+2)) + br + trailing, None, None, None)])
     return out
 
 
-def render_grids(grids, x, max_height):
+def layout_hud(grids, x):
     """
-        Prints out the grids on the right side of the game.
+        Lays out the grids on the right side of the game, as a list of HUD
+            text boxes for render_map to draw over the frame:
+            {'x': int, 'y': int, 'text': str, ('fg': rgb, 'bg': rgb, 'style': int)}
+
+        - grids: a list of rows of grids, the grids in a row are drawn side
+            by side. A grid is a list of rows from render_grid, or plain
+            strings.
     """
 
-    # Sort out grids
-    # Gets row from grid if it exists, else pads with ' '
-    get_row = lambda g, y: g[y] if y < len(g) else ' ' * len(uncolour_str(g[0]))
+    spans = lambda row: [(row, None, None, None)] if isinstance(row, str) else row
+    grid_width = lambda g: sum(len(span[0]) for span in spans(g[0]))
 
-    merged_grids = []
+    boxes = []
+    y = 0
     for row in grids:
-        for y in range(max(map(len, row))):
-            merged_grids.append(' '.join(map(lambda g: get_row(g, y), row)))
+        for grid_y in range(max(map(len, row))):
+            grid_x = x + 1
+
+            for grid in row:
+                if grid_y < len(grid):
+                    box_x = grid_x
+
+                    for text, fg, bg, style in spans(grid[grid_y]):
+                        box = {'x': box_x, 'y': y, 'text': text}
+                        if fg is not None: box['fg'] = fg
+                        if bg is not None: box['bg'] = bg
+                        if style is not None: box['style'] = style
+
+                        boxes.append(box)
+                        box_x += len(text)
+
+                grid_x += grid_width(grid) + 1
+
+            y += 1
+
+    return boxes
+
+
+def hud_pixels(hud):
+    """ Converts HUD text boxes into coloured pixels for each position. """
+
+    pixels = {}
+    for box in hud:
+        fg, bg = box.get('fg'), box.get('bg')
 
-    merged_grids.extend('' for _ in range(max_height - len(merged_grids)))
+        for dx, char in enumerate(box['text']):
+            pixels[box['x'] + dx, box['y']] = colour_str(
+                char,
+                bg = rgb(*bg) if bg is not None else None,
+                fg = rgb(*fg) if fg is not None else None,
+                style = box.get('style')
+            )
 
-    print(''.join(
-        POS_STR(x, y, ' ' + row + CLS_END_LN)
-            for y, row in enumerate(merged_grids)
-    ))
+    return pixels
@@ -6,6 +6,7 @@
 
 #include "colours.c"
 #include "data.c"
+#include "lighting.c"
 
 
 #include <stdint.h>
@@ -24,14 +25,21 @@
 PyObject *C_RENDERER_EXCEPTION;
 
 static PrintableChar *last_frame = 0;
-static LightingBuffer lighting_buffer = {.current_frame = 0, .screen = 0};
+static PrintableChar *hud_frame = 0;
+static LightingBuffer lighting_buffer = {.current_frame = 0, .scale = 1, .screen = 0};
 static bool resize;
 static bool redraw_all;
 static long width;
 static long height;
 
+// The frame is the map, with the HUD drawn to the right of it.
+static long map_width;
+static long hud_width;
+
 static int frame_id = 1;
 
+static Framebuffer framebuffer = {.fd = -1};
+
 
 #define S_POS_STR_FORMAT L"\033[%ld;%ldH"
 #define POS_STR_FORMAT_MAX_LEN (sizeof(S_POS_STR_FORMAT))
@@ -164,7 +172,7 @@ PyColour_AsColour(PyObject *py_colour)
     Colour rgb;
     rgb.r = -1;
 
-    if (py_colour)
+    if (py_colour && py_colour != Py_None)
     {
         rgb.r = PyFloat_AsDouble(PyTuple_GetItem(py_colour, 0));
         rgb.g = PyFloat_AsDouble(PyTuple_GetItem(py_colour, 1));
@@ -230,6 +238,109 @@ get_lighting_buffer_pixel(LightingBuffer *lighting_buffer, int x, int y, struct
 }
 
 
+long
+align_to_lighting_sample(long buffer_pos, long scale)
+{
+    // Rounds buffer_pos up to the position of the next lighting sample
+    long result = (buffer_pos / scale) * scale;
+    if (result < buffer_pos)
+    {
+        result += scale;
+    }
+    return result;
+}
+
+
+bool
+sample_lighting_buffer(LightingBuffer *lighting_buffer, long lb_x, long lb_y, bool underground, Colour *unlit_bg, struct PixelLighting *result)
+{
+    /*
+        Gets the lighting for the pixel at lb_x, lb_y, relative to the buffer.
+        - At full resolution this is just the buffer pixel.
+        - Otherwise the lightness is bilinearly interpolated from the four
+            surrounding samples.
+        - The background colour is only interpolated from samples on the same
+            side of the ground as the pixel, with unlit samples counting as
+            unlit_bg. This stops light bleeding between the sky and caves.
+            Solid blocks are masked by create_pixel at full resolution.
+    */
+
+    long scale = lighting_buffer->scale;
+    long sample_x = lb_x / scale;
+    long sample_y = lb_y / scale;
+
+    if (lb_x < 0 || sample_x >= lighting_buffer->width ||
+        lb_y < 0 || sample_y >= lighting_buffer->height)
+    {
+        return false;
+    }
+
+    struct PixelLighting *pixel;
+
+    if (scale == 1)
+    {
+        get_lighting_buffer_pixel(lighting_buffer, sample_x, sample_y, &pixel);
+        *result = *pixel;
+        return true;
+    }
+
+    float fx = (float)(lb_x % scale) / (float)scale;
+    float fy = (float)(lb_y % scale) / (float)scale;
+
+    float weights[4] = {(1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy};
+    long sample_dx[4] = {0, 1, 0, 1};
+    long sample_dy[4] = {0, 0, 1, 1};
+
+    float lightness = 0, lightness_weight = 0;
+    Colour bg = {{0, 0, 0}};
+    float bg_weight = 0;
+
+    int i;
+    for (i = 0; i < 4; ++i)
+    {
+        long x = sample_x + sample_dx[i];
+        long y = sample_y + sample_dy[i];
+
+        if (weights[i] <= 0 || x >= lighting_buffer->width || y >= lighting_buffer->height)
+            continue;
+
+        get_lighting_buffer_pixel(lighting_buffer, x, y, &pixel);
+
+        lightness += weights[i] * pixel->lightness;
+        lightness_weight += weights[i];
+
+        if (pixel->underground == underground)
+        {
+            Colour *colour = unlit_bg;
+            if (pixel->background_colour_set_on_frame == lighting_buffer->current_frame)
+            {
+                colour = &pixel->background_colour;
+            }
+
+            bg.r += weights[i] * colour->r;
+            bg.g += weights[i] * colour->g;
+            bg.b += weights[i] * colour->b;
+            bg_weight += weights[i];
+        }
+    }
+
+    result->lightness = lightness / lightness_weight;
+    result->lightness_set_on_frame = lighting_buffer->current_frame;
+
+    if (bg_weight > 0)
+    {
+        result->background_colour = (Colour){{bg.r / bg_weight, bg.g / bg_weight, bg.b / bg_weight}};
+        result->background_colour_set_on_frame = lighting_buffer->current_frame;
+    }
+    else
+    {
+        result->background_colour_set_on_frame = 0;
+    }
+
+    return true;
+}
+
+
 int
 objects_hash_func(long x, long y)
 {
@@ -342,11 +453,13 @@ create_pixel(long screen_x, long world_x, long world_y, PyObject *map, wchar_t p
     long lb_x = world_x - lighting_buffer->x;
     long lb_y = world_y - lighting_buffer->y;
 
+    Colour unlit_bg = underground ? cave_colour : *sky_colour_rgb;
+
+    struct PixelLighting sampled_pixel;
     struct PixelLighting *lighting_pixel = NULL;
-    if (lb_x >= 0 && lb_x < lighting_buffer->width &&
-        lb_y >= 0 && lb_y < lighting_buffer->height)
+    if (sample_lighting_buffer(lighting_buffer, lb_x, lb_y, underground, &unlit_bg, &sampled_pixel))
     {
-        get_lighting_buffer_pixel(lighting_buffer, lb_x, lb_y, &lighting_pixel);
+        lighting_pixel = &sampled_pixel;
     }
     else
     {
@@ -360,19 +473,28 @@ create_pixel(long screen_x, long world_x, long world_y, PyObject *map, wchar_t p
     {
         // lighting_pixel->background_colour_set_on_frame is only set for lit pixels, set the rest to sky_colour/cave colour.
 
-        if (lighting_pixel != NULL && lighting_pixel->background_colour_set_on_frame == lighting_buffer->current_frame)
+        bool bk_object_pixel = false;
+
+        int i;
+        for (i = 0; i < lighting_buffer->n_bk_object_pixels; ++i)
         {
-            result->bg = lighting_pixel->background_colour;
+            struct BkObjectPixel *bk_pixel = lighting_buffer->bk_object_pixels + i;
+            if (bk_pixel->x == world_x && bk_pixel->y == world_y)
+            {
+                result->bg = bk_pixel->colour;
+                bk_object_pixel = true;
+            }
         }
-        else
+
+        if (!bk_object_pixel)
         {
-            if (underground)
+            if (lighting_pixel != NULL && lighting_pixel->background_colour_set_on_frame == lighting_buffer->current_frame)
             {
-                result->bg = cave_colour;
+                result->bg = lighting_pixel->background_colour;
             }
             else
             {
-                result->bg = *sky_colour_rgb;
+                result->bg = unlit_bg;
             }
         }
     }
@@ -483,6 +605,11 @@ add_light_pixel_colour_to_lighting_buffer(Settings *settings, struct PixelLighti
     {
         visible = true;
     }
+    // Samples are shared between pixels when the buffer is not at full resolution, so blocks are masked in create_pixel instead.
+    else if (lighting_buffer.scale > 1)
+    {
+        visible = true;
+    }
     else
     {
         // Check if there is no block or a block without a clear background at this position.
@@ -585,6 +712,8 @@ add_bk_objects_pixels_colour_to_lighting_buffer(PyObject *bk_objects, PyObject *
 {
     /*
         Adds the pixels of the background objects (sun and moon).
+        - The pixels are stored in their own list rather than the buffer
+            samples, so they stay sharp at any lighting resolution.
         - Because the function is only setting ~4 blocks with the current
             usage for bk_objects, this function does not mask around solid
             blocks (create_pixel won't use background pixels it doesn't need
@@ -596,6 +725,8 @@ add_bk_objects_pixels_colour_to_lighting_buffer(PyObject *bk_objects, PyObject *
             objects.
     */
 
+    lighting_buffer.n_bk_object_pixels = 0;
+
     PyObject *iter = PyObject_GetIter(bk_objects);
     PyObject *bk_object;
     while ((bk_object = PyIter_Next(iter)))
@@ -611,7 +742,7 @@ add_bk_objects_pixels_colour_to_lighting_buffer(PyObject *bk_objects, PyObject *
         {
             long buffer_x = world_x - lighting_buffer.x;
 
-            if (buffer_x >= 0 && buffer_x < lighting_buffer.width)
+            if (buffer_x >= 0 && buffer_x < lighting_buffer.width * lighting_buffer.scale)
             {
                 long ground_height_world = PyFloat_AsDouble(PyDict_GetItem(slice_heights, PyLong_FromLong(world_x)));
                 long world_top_to_ground = world_gen_height - ground_height_world;
@@ -622,13 +753,14 @@ add_bk_objects_pixels_colour_to_lighting_buffer(PyObject *bk_objects, PyObject *
                     long buffer_y = world_y - lighting_buffer.y;
 
                     if (world_y < world_top_to_ground &&
-                        buffer_y >= 0 && buffer_y < lighting_buffer.height)
+                        buffer_y >= 0 && buffer_y < lighting_buffer.height * lighting_buffer.scale &&
+                        lighting_buffer.n_bk_object_pixels < MAX_BK_OBJECT_PIXELS)
                     {
-                        struct PixelLighting *pixel;
-                        get_lighting_buffer_pixel(&lighting_buffer, buffer_x, buffer_y, &pixel);
+                        struct BkObjectPixel *pixel = lighting_buffer.bk_object_pixels + lighting_buffer.n_bk_object_pixels++;
 
-                        pixel->background_colour = o_colour;
-                        pixel->background_colour_set_on_frame = lighting_buffer.current_frame;
+                        pixel->x = world_x;
+                        pixel->y = world_y;
+                        pixel->colour = o_colour;
                     }
                 }
             }
@@ -643,14 +775,19 @@ add_daylight_lightness_to_lighting_buffer(PyObject *lights, PyObject *slice_heig
     /*
         Fills in all the gaps of the lightness lighting buffer with daylight, also overwrites darker than daylight parts.
     */
-    long x, y;
-    for (x = 0; x < lighting_buffer.width; ++x)
+    long scale = lighting_buffer.scale;
+
+    long sample_x, sample_y;
+    for (sample_x = 0; sample_x < lighting_buffer.width; ++sample_x)
     {
+        long x = sample_x * scale;
+
         long ground_height_world = PyFloat_AsDouble(PyDict_GetItem(slice_heights, PyLong_FromLong(lighting_buffer.x+x)));
         long ground_height_buffer = (world_gen_height - ground_height_world) - lighting_buffer.y;
 
-        for (y = 0; y < lighting_buffer.height; ++y)
+        for (sample_y = 0; sample_y < lighting_buffer.height; ++sample_y)
         {
+            long y = sample_y * scale;
             float lightness;
 
             if (y < ground_height_buffer)
@@ -674,7 +811,7 @@ add_daylight_lightness_to_lighting_buffer(PyObject *lights, PyObject *slice_heig
             }
 
             struct PixelLighting *pixel;
-            get_lighting_buffer_pixel(&lighting_buffer, x, y, &pixel);
+            get_lighting_buffer_pixel(&lighting_buffer, sample_x, sample_y, &pixel);
 
             if (pixel->lightness < lightness ||
                 pixel->lightness_set_on_frame != lighting_buffer.current_frame)
@@ -683,6 +820,8 @@ add_daylight_lightness_to_lighting_buffer(PyObject *lights, PyObject *slice_heig
                 pixel->lightness_set_on_frame = lighting_buffer.current_frame;
             }
 
+            pixel->underground = y > ground_height_buffer;
+
             // TODO: Assert pixel->lightness_set_on_frame == lighting_buffer.current_frame
         }
     }
@@ -725,20 +864,23 @@ fill_lighting_buffer(PyObject *lights, PyObject *bk_objects, PyObject *map, Sett
         long buffer_x_pos = light.world_x - lighting_buffer.x;
         long buffer_y_pos = light.world_y - lighting_buffer.y;
 
+        // Only visit the pixels which have a sample in the buffer
+        long scale = lighting_buffer.scale;
+
         long buffer_x, buffer_y;
-        for (buffer_x = buffer_x_pos - light.radius; buffer_x <= buffer_x_pos + light.radius; ++buffer_x)
+        for (buffer_x = align_to_lighting_sample(buffer_x_pos - light.radius, scale); buffer_x <= buffer_x_pos + light.radius; buffer_x += scale)
         {
-            for (buffer_y = buffer_y_pos - light.radius; buffer_y <= buffer_y_pos + light.radius; ++buffer_y)
+            for (buffer_y = align_to_lighting_sample(buffer_y_pos - light.radius, scale); buffer_y <= buffer_y_pos + light.radius; buffer_y += scale)
             {
                 // Is pixel on screen?
-                if ((buffer_x >= 0 && buffer_x < lighting_buffer.width) &&
-                    (buffer_y >= 0 && buffer_y < lighting_buffer.height))
+                if ((buffer_x >= 0 && buffer_x / scale < lighting_buffer.width) &&
+                    (buffer_y >= 0 && buffer_y / scale < lighting_buffer.height))
                 {
                     float light_distance = lit(buffer_x, buffer_y, buffer_x_pos, buffer_y_pos, light.width, light.height, light.radius);
                     if (light_distance < 1)
                     {
                         struct PixelLighting *lighting_pixel;
-                        get_lighting_buffer_pixel(&lighting_buffer, buffer_x, buffer_y, &lighting_pixel);
+                        get_lighting_buffer_pixel(&lighting_buffer, buffer_x / scale, buffer_y / scale, &lighting_pixel);
 
                         if (add_this_lights_lightness)
                         {
@@ -850,6 +992,81 @@ filter_objects(PyObject *objects, ObjectsMap *objects_map, long left_edge, long
 }
 
 
+long
+get_hud_extent(PyObject *hud)
+{
+    // Returns the column after the right-most character of the HUD boxes
+
+    long result = 0;
+
+    PyObject *iter = PyObject_GetIter(hud);
+    PyObject *box;
+    while ((box = PyIter_Next(iter)))
+    {
+        long box_end = PyLong_AsLong(PyDict_GetItemString(box, "x")) +
+                       PyUnicode_GetLength(PyDict_GetItemString(box, "text"));
+        if (box_end > result)
+        {
+            result = box_end;
+        }
+        Py_DECREF(box);
+    }
+    Py_XDECREF(iter);
+
+    return result;
+}
+
+
+void
+composite_hud(PyObject *hud)
+{
+    /*
+        Draws the HUD text boxes into hud_frame, for render_map to lay over
+            the map before diffing with last_frame.
+        Each box is a dict: {'x': int, 'y': int, 'text': str, ('fg': rgb, 'bg': rgb, 'style': int)}
+    */
+
+    long i;
+    for (i = 0; i < width * height; ++i)
+    {
+        hud_frame[i].character = 0;
+    }
+
+    PyObject *iter = PyObject_GetIter(hud);
+    PyObject *box;
+    while ((box = PyIter_Next(iter)))
+    {
+        long x = PyLong_AsLong(PyDict_GetItemString(box, "x"));
+        long y = PyLong_AsLong(PyDict_GetItemString(box, "y"));
+
+        PrintableChar c = {
+            .fg = PyColour_AsColour(PyDict_GetItemString(box, "fg")),
+            .bg = PyColour_AsColour(PyDict_GetItemString(box, "bg")),
+            .style = get_long_from_PyDict_or(box, "style", -1)
+        };
+
+        Py_ssize_t size;
+        wchar_t *text = PyUnicode_AsWideCharString(PyDict_GetItemString(box, "text"), &size);
+        if (text)
+        {
+            Py_ssize_t dx;
+            for (dx = 0; dx < size; ++dx)
+            {
+                if (x + dx >= 0 && x + dx < width &&
+                    y >= 0 && y < height)
+                {
+                    c.character = text[dx];
+                    hud_frame[y * width + x + dx] = c;
+                }
+            }
+            PyMem_Free(text);
+        }
+        Py_DECREF(box);
+    }
+    Py_XDECREF(iter);
+}
+
+
 bool
 terminal_out(ScreenBuffer *frame, PrintableChar *c, long x, long y, Settings *settings)
 {
@@ -878,6 +1095,157 @@ terminal_out(ScreenBuffer *frame, PrintableChar *c, long x, long y, Settings *se
 }
 
 
+uint8_t
+colour_channel_to_byte(float c)
+{
+    return c <= 0 ? 0 : c >= 1 ? 255 : (uint8_t)(c * 255 + .5f);
+}
+
+
+bool
+setup_framebuffer(Framebuffer *fb, const char *path, long new_width, long new_height)
+{
+    size_t new_size = sizeof(FramebufferHeader) + new_width * new_height * sizeof(FramebufferCell);
+
+    // The file is only ever grown, so a reader can never touch a page which
+    //   has been truncated out from under it.
+    bool new_path = strncmp(fb->path, path, PATH_MAX) != 0;
+    if (!new_path && fb->size >= new_size)
+        return true;
+
+    if (fb->header)
+    {
+        munmap(fb->header, fb->size);
+        fb->header = 0;
+        fb->cells = 0;
+        fb->size = 0;
+    }
+    if (new_path && fb->fd >= 0)
+    {
+        close(fb->fd);
+        fb->fd = -1;
+        fb->path[0] = '\0';
+    }
+
+    if (fb->fd < 0)
+    {
+        fb->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fb->fd < 0)
+        {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+            return false;
+        }
+        strncpy(fb->path, path, PATH_MAX - 1);
+    }
+
+    struct stat file_stat;
+    if (fstat(fb->fd, &file_stat) != 0)
+    {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return false;
+    }
+    if ((size_t)file_stat.st_size < new_size)
+    {
+        if (ftruncate(fb->fd, new_size) != 0)
+        {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+            return false;
+        }
+    }
+    else
+    {
+        new_size = file_stat.st_size;
+    }
+
+    void *mapped = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return false;
+    }
+
+    fb->size = new_size;
+    fb->header = (FramebufferHeader *)mapped;
+    fb->cells = (FramebufferCell *)((char *)mapped + sizeof(FramebufferHeader));
+
+    // Carry on from the previous sequence number if the file was ours, so
+    //   readers which are already attached see the change.
+    if (fb->header->magic != FRAMEBUFFER_MAGIC || fb->header->version != FRAMEBUFFER_VERSION)
+    {
+        fb->header->sequence = 0;
+    }
+
+    fb->header->magic = FRAMEBUFFER_MAGIC;
+    fb->header->version = FRAMEBUFFER_VERSION;
+    fb->header->header_size = sizeof(FramebufferHeader);
+    fb->header->cell_size = sizeof(FramebufferCell);
+
+    return true;
+}
+
+
+void
+framebuffer_begin(Framebuffer *fb)
+{
+    // A frame which errored part way through may have left the sequence odd.
+    volatile uint32_t *sequence = &fb->header->sequence;
+    if (!(*sequence & 1))
+    {
+        *sequence += 1;
+    }
+    __sync_synchronize();
+
+    fb->header->width = width;
+    fb->header->height = height;
+    fb->header->map_width = map_width;
+}
+
+
+void
+framebuffer_end(Framebuffer *fb)
+{
+    volatile uint32_t *sequence = &fb->header->sequence;
+    __sync_synchronize();
+    *sequence += 1;
+}
+
+
+void
+framebuffer_out(Framebuffer *fb, PrintableChar *c, long x, long y, bool hud)
+{
+    FramebufferCell *cell = fb->cells + y * width + x;
+
+    cell->flags = hud ? FRAMEBUFFER_HUD : 0;
+
+    if (c->fg.r >= 0)
+    {
+        cell->fg[0] = colour_channel_to_byte(c->fg.r);
+        cell->fg[1] = colour_channel_to_byte(c->fg.g);
+        cell->fg[2] = colour_channel_to_byte(c->fg.b);
+        cell->flags |= FRAMEBUFFER_FG_SET;
+    }
+    else
+    {
+        memset(cell->fg, 0, sizeof(cell->fg));
+    }
+
+    if (c->bg.r >= 0)
+    {
+        cell->bg[0] = colour_channel_to_byte(c->bg.r);
+        cell->bg[1] = colour_channel_to_byte(c->bg.g);
+        cell->bg[2] = colour_channel_to_byte(c->bg.b);
+        cell->flags |= FRAMEBUFFER_BG_SET;
+    }
+    else
+    {
+        memset(cell->bg, 0, sizeof(cell->bg));
+    }
+
+    cell->style = c->style >= 0 ? c->style : 0;
+    cell->character = c->character;
+}
+
+
 bool
 setup_frame(ScreenBuffer *frame, long new_width, long new_height)
 {
@@ -909,6 +1277,13 @@ setup_frame(ScreenBuffer *frame, long new_width, long new_height)
             PyErr_SetString(C_RENDERER_EXCEPTION, "Could not allocate last frame buffer!");
             return false;
         }
+
+        hud_frame = (PrintableChar *)realloc(hud_frame, width * height * sizeof(PrintableChar));
+        if (!hud_frame)
+        {
+            PyErr_SetString(C_RENDERER_EXCEPTION, "Could not allocate HUD frame buffer!");
+            return false;
+        }
     }
 
     frame->cur_pos = 0;
@@ -930,12 +1305,13 @@ render_map(PyObject *self, PyObject *args)
     PyObject *map,
              *slice_heights,
              *objects,
+             *hud,
              *py_sky_colour,
              *py_settings;
 
-    if (!PyArg_ParseTuple(args, "OO(ll)(ll)OOOl:render_map", &map, &slice_heights,
+    if (!PyArg_ParseTuple(args, "OO(ll)(ll)OOOOl:render_map", &map, &slice_heights,
             &left_edge, &right_edge, &top_edge, &bottom_edge,
-            &objects, &py_sky_colour, &py_settings, &redraw_all))
+            &objects, &hud, &py_sky_colour, &py_settings, &redraw_all))
     {
         PyErr_SetString(C_RENDERER_EXCEPTION, "Could not parse arguments!");
         return NULL;
@@ -946,16 +1322,42 @@ render_map(PyObject *self, PyObject *args)
 
     Settings settings = {
         .terminal_output = PyLong_AsLong(PyDict_GetItemString(py_settings, "terminal_output")),
+        .neopixels_output = get_long_from_PyDict_or(py_settings, "neopixels", 0),
         .fancy_lights = PyLong_AsLong(PyDict_GetItemString(py_settings, "fancy_lights")),
-        .colours = PyLong_AsLong(PyDict_GetItemString(py_settings, "colours"))
+        .colours = PyLong_AsLong(PyDict_GetItemString(py_settings, "colours")),
+        .lighting_resolution = get_long_from_PyDict_or(py_settings, "lighting_resolution", 1)
     };
 
-    long cur_width = right_edge - left_edge;
+    long cur_map_width = right_edge - left_edge;
     long cur_height = bottom_edge - top_edge;
 
-    if (!setup_frame(&frame, cur_width, cur_height))
+    // Keep the HUD area as wide as it has been, so characters left by a wider HUD get cleared.
+    if (cur_map_width != map_width)
+    {
+        map_width = cur_map_width;
+        hud_width = 0;
+    }
+    long hud_extent = get_hud_extent(hud) - map_width;
+    if (hud_extent > hud_width)
+    {
+        hud_width = hud_extent;
+    }
+
+    if (!setup_frame(&frame, map_width + hud_width, cur_height))
         return NULL;
 
+    composite_hud(hud);
+
+    if (settings.neopixels_output > 0)
+    {
+        PyObject *py_path = PyDict_GetItemString(py_settings, "neopixels_path");
+        const char *path = py_path && PyUnicode_Check(py_path) ? PyUnicode_AsUTF8(py_path) : "neopixels.fb";
+        if (!path || !setup_framebuffer(&framebuffer, path, width, height))
+            return NULL;
+
+        framebuffer_begin(&framebuffer);
+    }
+
     if (!PyDict_Check(map))
     {
         PyErr_SetString(C_RENDERER_EXCEPTION, "Map is not a dict!");
@@ -1004,11 +1406,21 @@ render_map(PyObject *self, PyObject *args)
                 PrintableChar printable_char;
                 create_pixel(screen_x, world_x_l, world_y_l, map, pixel, &objects_map, &lighting_buffer, underground, &sky_colour_rgb, &settings, &printable_char);
 
+                PrintableChar *hud_char = hud_frame + screen_y * width + screen_x;
+                if (hud_char->character != 0)
+                {
+                    printable_char = *hud_char;
+                }
+
                 if (settings.terminal_output > 0)
                 {
                     if (!terminal_out(&frame, &printable_char, screen_x, screen_y, &settings))
                         return NULL;
                 }
+                if (settings.neopixels_output > 0)
+                {
+                    framebuffer_out(&framebuffer, &printable_char, screen_x, screen_y, hud_char->character != 0);
+                }
             }
 
             ++world_y_l;
@@ -1018,6 +1430,40 @@ render_map(PyObject *self, PyObject *args)
         Py_XDECREF(iter);
     }
 
+    // Draw the HUD area to the right of the map
+    if (settings.terminal_output > 0 || settings.neopixels_output > 0)
+    {
+        static PrintableChar blank_char = {.character = L' ', .fg = {{-1, 0, 0}}, .bg = {{-1, 0, 0}}, .style = -1};
+
+        long screen_x, screen_y;
+        for (screen_y = 0; screen_y < height; ++screen_y)
+        {
+            for (screen_x = map_width; screen_x < width; ++screen_x)
+            {
+                PrintableChar *hud_char = hud_frame + screen_y * width + screen_x;
+                if (hud_char->character == 0)
+                {
+                    hud_char = &blank_char;
+                }
+
+                if (settings.terminal_output > 0)
+                {
+                    if (!terminal_out(&frame, hud_char, screen_x, screen_y, &settings))
+                        return NULL;
+                }
+                if (settings.neopixels_output > 0)
+                {
+                    framebuffer_out(&framebuffer, hud_char, screen_x, screen_y, true);
+                }
+            }
+        }
+    }
+
+    if (settings.neopixels_output > 0)
+    {
+        framebuffer_end(&framebuffer);
+    }
+
     if (settings.terminal_output > 0)
     {
         frame.buffer[frame.cur_pos] = L'\0';
@@ -1062,14 +1508,30 @@ create_lighting_buffer(PyObject *self, PyObject *args)
 
     Settings settings = {
         .terminal_output = PyLong_AsLong(PyDict_GetItemString(py_settings, "terminal_output")),
+        .neopixels_output = get_long_from_PyDict_or(py_settings, "neopixels", 0),
         .fancy_lights = PyLong_AsLong(PyDict_GetItemString(py_settings, "fancy_lights")),
-        .colours = PyLong_AsLong(PyDict_GetItemString(py_settings, "colours"))
+        .colours = PyLong_AsLong(PyDict_GetItemString(py_settings, "colours")),
+        .lighting_resolution = get_long_from_PyDict_or(py_settings, "lighting_resolution", 1)
     };
 
     lighting_buffer.x = world_x;
     lighting_buffer.y = world_y;
 
+    // Samples are taken every `scale` pixels, plus one extra sample on the
+    //   right and bottom edges for create_pixel to interpolate towards.
+    long scale = settings.lighting_resolution > 1 ? settings.lighting_resolution : 1;
+    if (scale > 1)
+    {
+        new_width = (new_width + scale - 1) / scale + 1;
+        new_height = (new_height + scale - 1) / scale + 1;
+    }
+
     bool resize = false;
+    if (scale != lighting_buffer.scale)
+    {
+        resize = true;
+        lighting_buffer.scale = scale;
+    }
     if (new_width != lighting_buffer.width)
     {
         resize = true;
@@ -1117,13 +1579,10 @@ get_world_light_level(PyObject *self, PyObject *args)
     long buffer_x = world_x - lighting_buffer.x;
     long buffer_y = world_y - lighting_buffer.y;
 
-    if (buffer_x >= 0 && buffer_x < lighting_buffer.width &&
-        buffer_y >= 0 && buffer_y < lighting_buffer.height)
+    struct PixelLighting lighting_pixel;
+    if (sample_lighting_buffer(&lighting_buffer, buffer_x, buffer_y, false, &cave_colour, &lighting_pixel))
     {
-        struct PixelLighting *lighting_pixel;
-        get_lighting_buffer_pixel(&lighting_buffer, buffer_x, buffer_y, &lighting_pixel);
-
-        result = lighting_pixel->lightness;
+        result = lighting_pixel.lightness;
     }
     else
     {
@@ -1135,7 +1594,7 @@ get_world_light_level(PyObject *self, PyObject *args)
 
 
 static PyMethodDef render_c_methods[] = {
-    {"render_map", render_map, METH_VARARGS, PyDoc_STR("    render_map(map, slice_heights, edges, edges_y, objects, sky_colour, settings, redraw_all) -> None")},
+    {"render_map", render_map, METH_VARARGS, PyDoc_STR("    render_map(map, slice_heights, edges, edges_y, objects, hud, sky_colour, settings, redraw_all) -> None")},
     {"create_lighting_buffer", create_lighting_buffer, METH_VARARGS, PyDoc_STR("create_lighting_buffer(width, height, x, y, map, slice_heights, bk_objects, sky_colour, day, lights, py_settings) -> None")},
     {"get_world_light_level", get_world_light_level, METH_VARARGS, PyDoc_STR("get_world_light_level(world_x, world_y) -> lightness")},
     {NULL, NULL}  /* sentinel */
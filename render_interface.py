@@ -30,9 +30,12 @@ def setup_render_module(settings):
     render_c = import_render_c()
 
 
-def create_lighting_buffer(width, height, x, y, map_, slice_heights, bk_objects, sky_colour, day, lights):
+def create_lighting_buffer(width, height, x, y, map_, slice_heights, bk_objects, sky_colour, day, lights, settings=None):
+    if settings is None:
+        settings = settings_ref
+
     if settings_ref['render_c']:
-        return render_c.create_lighting_buffer(width, height, x, y, map_, slice_heights, bk_objects, sky_colour, day, lights, settings_ref)
+        return render_c.create_lighting_buffer(width, height, x, y, map_, slice_heights, bk_objects, sky_colour, day, lights, settings)
     else:
         global day_global
         day_global = day
@@ -40,11 +43,13 @@ def create_lighting_buffer(width, height, x, y, map_, slice_heights, bk_objects,
         log('Not implemented: Python create_lighting_buffer function', m='warning')
 
 
-def render_map(map_, slice_heights, edges, edges_y, objects, bk_objects, sky_colour, day, lights, settings, redraw_all):
+def render_map(map_, slice_heights, edges, edges_y, objects, hud, bk_objects, sky_colour, day, lights, settings, redraw_all):
     if settings_ref['render_c']:
-        return render_c.render_map(map_, slice_heights, edges, edges_y, objects, sky_colour, settings, redraw_all)
+        return render_c.render_map(map_, slice_heights, edges, edges_y, objects, hud, sky_colour, settings, redraw_all)
     else:
-        return render.render_map(map_, slice_heights, edges, edges_y, objects, bk_objects, sky_colour, day, lights, settings, redraw_all)
+        if settings.get('neopixels'):
+            log('Not implemented: Python neopixels output', m='warning')
+        return render.render_map(map_, slice_heights, edges, edges_y, objects, hud, bk_objects, sky_colour, day, lights, settings, redraw_all)
 
 
 def get_light_level(*args):
@@ -0,0 +1,133 @@
+"""
+Replicates entity state to clients as deltas.
+
+The server marks entities as changed as the game updates them, and once a
+    tick each client is sent one delta: the fields of the entities it can
+    see which differ from what it was last sent, and the entities it should
+    forget. So the traffic to a client is bounded by the tick rate, not by
+    how often the game changes things.
+
+Each delta has a sequence number. A client which sees a gap (a delta
+    skipped for being slow) asks for a resync, and is sent everything it
+    can see again.
+
+Deltas also acknowledge the client's last movement input the server has
+    applied, so the client can tell which of its predicted moves the
+    positions it is sent include.
+"""
+
+from copy import deepcopy
+
+from interest import KINDS
+
+
+# Positions are sent rounded to whole blocks.
+QUANTIZED = {'x', 'y'}
+
+_MISSING = object()
+
+
+def quantize(fields):
+    return {field: int(round(value)) if field in QUANTIZED and isinstance(value, float) else value
+            for field, value in fields.items()}
+
+
+class Replication:
+    def __init__(self):
+        # name: {kind: {id: {field: value}}}, what each client was last sent
+        self._sent = {}
+        # name: {kind: set(id)}, entities to send, and to forget, in each client's next delta
+        self._shown = {}
+        self._removed = {}
+        self._full = set()
+        self._seq = {}
+        # name: [last input applied, last input acknowledged]
+        self._acks = {}
+
+    def _client(self, name):
+        if name not in self._sent:
+            self._sent[name] = {kind: {} for kind in KINDS}
+            self._shown[name] = {kind: set() for kind in KINDS}
+            self._removed[name] = {kind: set() for kind in KINDS}
+            self._seq[name] = 0
+            self._acks[name] = [0, 0]
+
+    def remove_client(self, name):
+        for clients in (self._sent, self._shown, self._removed, self._seq, self._acks):
+            clients.pop(name, None)
+        self._full.discard(name)
+
+    def show(self, name, kind, ids):
+        self._client(name)
+        self._shown[name][kind].update(ids)
+        self._removed[name][kind].difference_update(ids)
+
+    def remove(self, name, kind, ids):
+        self._client(name)
+        self._removed[name][kind].update(ids)
+        self._shown[name][kind].difference_update(ids)
+
+    def acknowledge(self, name, kind, id_, fields):
+        """ Records that the client already has these fields, e.g. because it set them itself. """
+
+        self._client(name)
+        self._sent[name][kind].setdefault(id_, {}).update(deepcopy(quantize(fields)))
+
+    def ack(self, name, input_seq):
+        """ Records that the client's movement input has been applied. """
+
+        self._client(name)
+        self._acks[name][0] = max(self._acks[name][0], input_seq)
+
+    def reset(self, name, known):
+        """ Forgets what the client was sent, so its next delta has everything in known, {kind: ids}. """
+
+        acks = self._acks.get(name)
+        self.remove_client(name)
+        self._client(name)
+        if acks is not None:
+            self._acks[name][0] = acks[0]
+        for kind, ids in known.items():
+            self._shown[name][kind].update(ids)
+        self._full.add(name)
+
+    def delta(self, name, sources):
+        """ Returns the client's delta message for this tick, or None. sources is {kind: {id: entity}}. """
+
+        if name not in self._sent:
+            return None
+
+        changes = {}
+        removed = {}
+        for kind in KINDS:
+            sent = self._sent[name][kind]
+            source = sources[kind]
+
+            for id_ in self._shown[name][kind]:
+                if id_ not in source:
+                    continue
+
+                base = sent.setdefault(id_, {})
+                changed = {field: value for field, value in quantize(source[id_]).items()
+                           if base.get(field, _MISSING) != value}
+                if changed:
+                    changes.setdefault(kind, {})[id_] = changed
+                    base.update(deepcopy(changed))
+
+            for id_ in self._removed[name][kind]:
+                sent.pop(id_, None)
+            if self._removed[name][kind]:
+                removed[kind] = list(self._removed[name][kind])
+
+            self._shown[name][kind] = set()
+            self._removed[name][kind] = set()
+
+        full = name in self._full
+        self._full.discard(name)
+        acks = self._acks[name]
+        if not (changes or removed or full or acks[0] != acks[1]):
+            return None
+
+        self._seq[name] += 1
+        acks[1] = acks[0]
+        return {'event': 'entity_delta', 'args': [self._seq[name], acks[0], full, changes, removed]}
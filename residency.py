@@ -0,0 +1,108 @@
+"""
+Tracks which chunks the server needs to keep loaded.
+
+Each view (a player's loaded edges) holds a reference to every chunk in it,
+    and keeps holding chunks until they are more than `margin` chunks
+    outside its edges, so walking back and forth over a chunk boundary
+    doesn't load and unload the same chunks.
+
+Chunks no view holds are kept run-length encoded in a ChunkCache, most
+    recently used last, until they go over its memory budget. Edits are
+    already in the save by then, so evicting a chunk just forgets it.
+"""
+
+import sys
+from collections import OrderedDict
+
+from terrain import world_gen
+
+
+chunk_size = world_gen['chunk_size']
+
+
+def edges_chunks(edges, margin=0):
+    """ The chunks overlapping the slices in range(*edges), and margin chunks either side. """
+    return range(edges[0] // chunk_size - margin, (edges[1] - 1) // chunk_size + 1 + margin)
+
+
+class Residency:
+    def __init__(self, margin=1):
+        self._margin = margin
+        self._views = {}
+        self._refs = {}
+
+    def set_view(self, name, edges):
+        """ Moves a view, and returns the chunks which no view holds any more. """
+
+        held = self._views.get(name, set())
+        keep = edges_chunks(edges, self._margin)
+        new_held = set(edges_chunks(edges)) | {chunk_n for chunk_n in held if chunk_n in keep}
+
+        for chunk_n in new_held - held:
+            self._refs[chunk_n] = self._refs.get(chunk_n, 0) + 1
+
+        self._views[name] = new_held
+        return self._release(held - new_held)
+
+    def remove_view(self, name):
+        return self._release(self._views.pop(name, set()))
+
+    def _release(self, chunks):
+        released = []
+        for chunk_n in chunks:
+            self._refs[chunk_n] -= 1
+            if self._refs[chunk_n] == 0:
+                del self._refs[chunk_n]
+                released.append(chunk_n)
+        return released
+
+    def referenced(self, chunk_n):
+        return chunk_n in self._refs
+
+
+def _size(columns, slice_heights):
+    return (sum(sys.getsizeof(column) + sys.getsizeof(column.ends) + sys.getsizeof(column.blocks) for column in columns) +
+            sys.getsizeof(slice_heights) + 32 * len(slice_heights))
+
+
+class ChunkCache:
+    """ An LRU of run-length encoded chunks, evicting the oldest when over budget bytes. """
+
+    def __init__(self, budget):
+        self._budget = budget
+        self._chunks = OrderedDict()
+        self.size = 0
+
+    def __contains__(self, chunk_n):
+        return chunk_n in self._chunks
+
+    def __len__(self):
+        return len(self._chunks)
+
+    def put(self, chunk_n, columns, slice_heights):
+        """ Adds a chunk, columns being RLEColumns in x order. Returns the chunks evicted to make room. """
+
+        self.pop(chunk_n)
+
+        size = _size(columns, slice_heights)
+        self._chunks[chunk_n] = columns, slice_heights, size
+        self.size += size
+
+        evicted = []
+        while self.size > self._budget and self._chunks:
+            old_chunk_n, (_, _, old_size) = self._chunks.popitem(last=False)
+            self.size -= old_size
+            evicted.append(old_chunk_n)
+
+        return evicted
+
+    def pop(self, chunk_n):
+        """ Removes a chunk, returning (columns, slice_heights), or None if it isn't cached. """
+
+        entry = self._chunks.pop(chunk_n, None)
+        if entry is None:
+            return None
+
+        columns, slice_heights, size = entry
+        self.size -= size
+        return columns, slice_heights
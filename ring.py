@@ -0,0 +1,48 @@
+"""
+A fixed size queue for passing items from one thread to one other thread.
+
+Only the producer moves the tail and only the consumer moves the head, so
+    neither side takes a lock.
+"""
+
+from time import sleep
+
+
+class Ring:
+    def __init__(self, size):
+        self._items = [None] * size
+        self._size = size
+        self._head = 0
+        self._tail = 0
+
+    def __len__(self):
+        return self._tail - self._head
+
+    def push(self, item):
+        """ Adds an item, returning False if the ring is full. Producer only. """
+
+        if self._tail - self._head == self._size:
+            return False
+
+        self._items[self._tail % self._size] = item
+        # The item is in place before the consumer can see it.
+        self._tail += 1
+        return True
+
+    def put(self, item, wait=0.001):
+        """ Adds an item, waiting for room. Producer only. """
+
+        while not self.push(item):
+            sleep(wait)
+
+    def pop(self):
+        """ Removes the oldest item, returning None if the ring is empty. Consumer only. """
+
+        if self._head == self._tail:
+            return None
+
+        i = self._head % self._size
+        item = self._items[i]
+        self._items[i] = None
+        self._head += 1
+        return item
@@ -0,0 +1,120 @@
+"""
+Run-length encoded map slices.
+
+A slice is mostly a run of air, the grass, a run of stone and the bedrock.
+    Caves and ores break the stone up, so for generated chunks storing the
+    runs is about 60% of the size of storing every block, and flat terrain
+    is much smaller. Blocks are looked up with a binary search over the
+    ends of the runs.
+"""
+
+import sys
+import struct
+from array import array
+from bisect import bisect_right
+from itertools import chain
+
+
+class RLEColumn:
+    """ A read-only slice, stored as the end of each run and the block it is made of. """
+
+    __slots__ = ('ends', 'blocks')
+
+    def __init__(self, ends, blocks):
+        self.ends = ends
+        self.blocks = blocks
+
+    @classmethod
+    def from_slice(cls, slice_):
+        ends = array('H')
+        blocks = []
+
+        for y, block in enumerate(slice_):
+            if blocks and blocks[-1] == block:
+                ends[-1] = y + 1
+            else:
+                ends.append(y + 1)
+                blocks.append(block)
+
+        return cls(ends, ''.join(blocks))
+
+    def __len__(self):
+        return self.ends[-1] if self.ends else 0
+
+    def __getitem__(self, y):
+        if y < 0:
+            y += len(self)
+        if not 0 <= y < len(self):
+            raise IndexError('RLEColumn index out of range')
+
+        return self.blocks[bisect_right(self.ends, y)]
+
+    def __eq__(self, other):
+        return isinstance(other, RLEColumn) and self.ends == other.ends and self.blocks == other.blocks
+
+    @property
+    def n_runs(self):
+        return len(self.ends)
+
+    def to_slice(self):
+        """ Expands back into the list of blocks the map uses. """
+
+        ends = self.ends
+        return list(''.join([block * (end - start) for block, start, end in zip(self.blocks, chain((0,), ends), ends)]))
+
+
+# On disk a chunk is its slice heights, then each column as the number of
+#   runs, the ends of the runs and the blocks they are made of.
+HEIGHT = struct.Struct('<H')
+N_RUNS = struct.Struct('<H')
+
+
+def encode_chunk(columns, slice_heights):
+    """ Packs lists of RLEColumns and slice heights, in x order, into bytes. """
+
+    heights = array('H', (int(h) for h in slice_heights))
+    if sys.byteorder == 'big':
+        heights.byteswap()
+    data = bytearray(heights.tobytes())
+
+    for column in columns:
+        ends = column.ends
+        if sys.byteorder == 'big':
+            ends = array('H', ends)
+            ends.byteswap()
+
+        data += N_RUNS.pack(column.n_runs)
+        data += ends.tobytes()
+        data += column.blocks.encode('ascii')
+
+    return bytes(data)
+
+
+def decode_chunk(data, chunk_size):
+    """ Unpacks encode_chunk's bytes into (columns, slice heights). """
+
+    data = memoryview(data)
+
+    heights_size = chunk_size * HEIGHT.size
+    slice_heights = array('H', data[:heights_size].tobytes())
+    if sys.byteorder == 'big':
+        slice_heights.byteswap()
+    slice_heights = slice_heights.tolist()
+    offset = heights_size
+
+    columns = []
+    for _ in range(chunk_size):
+        n_runs = N_RUNS.unpack_from(data, offset)[0]
+        offset += N_RUNS.size
+
+        ends = array('H', data[offset:offset + n_runs * 2].tobytes())
+        if sys.byteorder == 'big':
+            ends.byteswap()
+        offset += n_runs * 2
+
+        blocks = data[offset:offset + n_runs].tobytes().decode('ascii')
+        offset += n_runs
+
+        columns.append(RLEColumn(ends, blocks))
+
+    return columns, slice_heights
@@ -3,17 +3,21 @@ import json
 import random
 
 from shutil import rmtree
+from threading import Lock
 from collections import OrderedDict
 
-from terrain import world_gen
+from terrain import world_gen, WORLD_GEN_VERSION
 from console import log
 from data import timings
 from player import MAX_PLAYER_HEALTH
 
+import region
+
 
 default_meta = {
     'name': 'Untitled',
     'seed': lambda: hash(random.random()),
+    'world_gen_version': 1,
     'spawn': 0,
     'tick': timings['tick'],
     'players': {},
@@ -27,12 +31,17 @@ default_settings = {
     'name': None,
     'colours': True,
     'fancy_lights': True,
+    'adaptive_quality': True,
+    'lighting_resolution': 1,
     'terminal_output': True,
     'render_c': False,
     'neopixels': False,
+    'neopixels_path': 'neopixels.fb',
     'gravity': False,
     'flight': False,
     'mobs': False,
+    'chunk_workers': 2,
+    'chunk_cache_mb': 16,
     'width': 40,
     'height': 30
 }
@@ -46,12 +55,15 @@ default_player = {
 
 SAVES_DIR = 'saves'
 CHUNK_EXT = '.chunk'
-SAVE_LINE_LENGTH = world_gen['height'] + 3 + 1  # + slice_height + newline
-CHUNK_SIZE = world_gen['chunk_size'] * SAVE_LINE_LENGTH
 
 
+# Parts of the meta which change during play, each kept in its own file so
+#   they can be saved without rewriting the rest.
+META_RECORDS = ('players', 'mobs', 'items')
+
 save_path = lambda save, filename='': os.path.join(SAVES_DIR, save, filename)
 meta_path = lambda save: save_path(save, 'meta.json')
+record_path = lambda save, record: save_path(save, record + '.json')
 chunk_num = lambda x: int(x) // world_gen['chunk_size']
 
 
@@ -60,6 +72,8 @@ def check_map_dir():
 
 
 def new_save(meta):
+    # Saves without a version are from before it was added, so only new ones get the latest.
+    meta.setdefault('world_gen_version', WORLD_GEN_VERSION)
     meta = check_meta(meta)
 
     # Find unique dir name
@@ -82,6 +96,7 @@ def new_save(meta):
 
 
 def delete_save(save):
+    close_regions(save)
     rmtree(save_path(save))
 
 
@@ -96,7 +111,59 @@ def chunk_file_name(save, chunk_n):
     return save_path(save, str(chunk_n) + CHUNK_EXT)
 
 
+_regions = {}
+_regions_lock = Lock()
+
+
+def get_region(save, chunk_n, create=True):
+    """ Returns the open Region holding chunk_n, opening or creating it if needed. """
+
+    key = (save, region.region_num(chunk_n))
+    with _regions_lock:
+        region_ = _regions.get(key)
+        if region_ is None:
+            path = save_path(save, str(key[1]) + region.REGION_EXT)
+            if not create and not os.path.isfile(path):
+                return None
+
+            region_ = _regions[key] = region.Region(path, world_gen['chunk_size'], world_gen['height'])
+
+    return region_
+
+
+def close_regions(save=None):
+    with _regions_lock:
+        for key in list(_regions.keys()):
+            if save is None or key[0] == save:
+                _regions.pop(key).close()
+
+
+def chunk_exists(save, chunk_n):
+    region_ = get_region(save, chunk_n, create=False)
+    return (region_ is not None and region_.has(chunk_n)) or os.path.isfile(chunk_file_name(save, chunk_n))
+
+
 def load_chunk(save, chunk_n):
+    """ Loads a chunk from its region file, or from its old .chunk file if it hasn't been written since. """
+
+    map_ = {}
+    slice_heights = {}
+    chunk_pos = chunk_n * world_gen['chunk_size']
+
+    region_ = get_region(save, chunk_n, create=False)
+    record = region_ and region_.read_chunk(chunk_n)
+    if not record:
+        return load_text_chunk(save, chunk_n)
+
+    columns, heights = record
+    for d_pos, column in enumerate(columns):
+        map_[chunk_pos + d_pos] = column.to_slice()
+        slice_heights[chunk_pos + d_pos] = heights[d_pos]
+
+    return map_, slice_heights
+
+
+def load_text_chunk(save, chunk_n):
     map_ = {}
     slice_heights = {}
     chunk_pos = chunk_n * world_gen['chunk_size']
@@ -130,20 +197,15 @@ def load_chunk(save, chunk_n):
 def save_chunk(save, chunk_n, chunk, slice_heights):
     """ Updates slices within one chunk. """
 
-    filename = chunk_file_name(save, chunk_n)
-    if os.path.isfile(filename):
-        mode = 'r+'
-    else:
-        mode = 'w'
-
-    with open(filename, mode) as file_:
-
-        file_.truncate(CHUNK_SIZE)
-        for pos, slice_ in chunk.items():
-            rel_pos = int(pos) % world_gen['chunk_size']
+    region_ = get_region(save, chunk_n)
+    with region_.lock:
+        # Move the rest of the chunk over from its .chunk file the first time it's written.
+        if not region_.has(chunk_n):
+            old_chunk, old_slice_heights = load_text_chunk(save, chunk_n)
+            if old_chunk:
+                region_.write(chunk_n, old_chunk, old_slice_heights)
 
-            file_.seek(int(rel_pos) * SAVE_LINE_LENGTH)
-            file_.write(''.join(slice_) + str(slice_heights[pos])[:3].zfill(3) + '\n')
+        region_.write(chunk_n, chunk, slice_heights)
 
 
 def save_slices(save, new_slices, slice_heights):
@@ -209,8 +271,15 @@ def save_settings(meta):
     save_json('settings.json', meta)
 
 
-def save_meta(save, meta):
-    save_json(meta_path(save), meta)
+def save_meta(save, meta, records=META_RECORDS):
+    """ Saves the meta and the given records of it. """
+
+    # Records from older saves are only in meta.json, so are moved out the first time.
+    for record in META_RECORDS:
+        if record in records or not os.path.isfile(record_path(save, record)):
+            save_json(record_path(save, record), meta[record])
+
+    save_json(meta_path(save), {key: value for key, value in meta.items() if key not in META_RECORDS})
 
 
 def get_global_meta():
@@ -222,12 +291,26 @@ def get_settings():
 
 
 def get_meta(save):
-    return load_meta(meta_path(save), default_meta)
+    meta = load_meta(meta_path(save), {key: value for key, value in default_meta.items() if key not in META_RECORDS})
+
+    for record in META_RECORDS:
+        try:
+            with open(record_path(save, record)) as f:
+                meta[record] = json.load(f)
+        except IOError:
+            # Older saves keep them in meta.json
+            meta.setdefault(record, {})
+
+    return meta
 
 
 def save_json(path, meta):
-    with open(path, 'w') as f:
-        json.dump(meta, f)
+    # Written in full before replacing the old file, so a crash can't leave half of it.
+    # Records which aren't dicts, like the mob store, are written as if they were.
+    data = json.dumps(meta, default=dict)
+    with open(path + '.tmp', 'w') as f:
+        f.write(data)
+    os.replace(path + '.tmp', path)
 
 
 def load_meta(path, default):
@@ -235,14 +318,21 @@ def load_meta(path, default):
         with open(path) as f:
             meta = json.load(f)
     except IOError:
-        meta = default
+        meta = set_defaults({}, default)
     else:
+        if has_defaults(meta, default):
+            return meta
         set_defaults(meta, default)
 
     save_json(path, meta)
     return meta
 
 
+def has_defaults(options, defaults):
+    return all(key in options and (not isinstance(default, dict) or has_defaults(options[key], default))
+               for key, default in defaults.items())
+
+
 def set_defaults(options, defaults):
     for key, default in defaults.items():
         if key not in options:
@@ -1,8 +1,19 @@
-from time import time
+"""
+The server owns the game, and shares it with the local player and any remote ones.
+
+Run on its own to host a save headless, with no local player, terminal or renderer:
+
+    python3 server.py <save> [port]
+"""
+
+import os
+import sys
+from time import time, sleep
 from math import radians, floor, ceil
-from threading import Thread
+from threading import Thread, Lock
+from concurrent.futures import Future, ThreadPoolExecutor
 
-import terrain, saves, network, mobs, items, render_interface
+import terrain, saves, network, mobs, items, render, render_interface, chunkgen, rle, journal, residency, interest, replication, pathfinding
 
 from colours import colour_str, TERM_YELLOW
 from console import log
@@ -10,6 +21,29 @@ from data import timings
 from player import MAX_PLAYER_HEALTH
 
 
+# Seconds between saving the parts of the meta which have changed.
+META_SAVE_INTERVAL = 5
+
+# How many chunks past its edges a view keeps holding chunks.
+VIEW_MARGIN_CHUNKS = 1
+
+# How many chunks past its edges a client is sent entities and block changes.
+INTEREST_MARGIN_CHUNKS = 1
+
+# Most ticks a headless server runs back to back to catch up, before it skips the rest.
+MAX_CATCH_UP_TICKS = 5
+
+# Mob spawn cycles each second on a headless server.
+HEADLESS_SPAWNS_PER_SECOND = 5
+
+# kind: (event setting some of them, event removing some of them)
+ENTITY_EVENTS = {
+    'players': ('set_players', 'remove_player'),
+    'mobs': ('set_mobs', 'remove_mobs'),
+    'items': ('add_items', 'remove_items'),
+}
+
+
 def _log_event(event, args):
     log('  Event:', colour_str(event, fg=TERM_YELLOW))
     log('  Args:', args)
@@ -39,39 +73,181 @@ def dt(last_tick):
     return dt, last_tick
 
 
+class NoLocalInterface:
+    """ Stands in for the local player's interface on a headless server. """
+
+    def handle(self, data):
+        pass
+
+
 class Server:
     def __init__(self, player, save, port, settings, local_interface):
         self.current_players = {}
         self.local_player = player
 
-        self.local_interface = local_interface
+        self.local_interface = local_interface or NoLocalInterface()
+        self._settings = settings
         self.game = Game(save, settings)
         self.default_port = port
 
+        # Who is waiting for each chunk which is loading: {chunk_n: [sock, ...]}, None for the local player
+        self._chunk_requests = {}
+        self._chunk_requests_lock = Lock()
+
+        # Which clients are sent which entities and block changes, and what they have been sent.
+        #   _dirty is the entities changed this tick: {kind: set(id)}
+        self._interest = interest.Interest(INTEREST_MARGIN_CHUNKS)
+        self._replication = replication.Replication()
+        self._dirty = {kind: set() for kind in interest.KINDS}
+        self._interest_lock = Lock()
+        for kind in ('mobs', 'items'):
+            for id_, entity in getattr(self.game, kind).items():
+                self._interest.move(kind, id_, entity['x'])
+
         self.serving = False
 
+        # On a headless server, ticks which took longer than a tick, and ticks skipped to catch up
+        self.slow_ticks = 0
+        self.skipped_ticks = 0
+
     def _update_clients(self, message, exclude=None):
         log_event_send(message['event'], message['args'], label='Server')
 
-        for name, sock in self.current_players.items():
-            if name != exclude:
-                network.send(sock, message)
+        socks = [sock for name, sock in self.current_players.items() if name != exclude]
+        if socks:
+            # Encoded once for every client
+            frame = network.frame(message)
+            for sock in socks:
+                network.send_frame(sock, frame)
 
         if self.local_player != exclude:
             self.local_interface.handle(message)
 
+    def _send_framed(self, frames, sock, message, key):
+        """ Sends a message, encoding it once for all the messages sent with the same key. """
+
+        if key not in frames:
+            log_event_send(message['event'], message['args'], label='Server')
+            frames[key] = network.frame(message)
+        network.send_frame(sock, frames[key])
+
+    def _update_entities(self, kind, entities):
+        """ Marks entities, {id: entity}, as changed, to be sent to the clients which can see them next tick. """
+
+        message = {'event': ENTITY_EVENTS[kind][0], 'args': [entities]}
+        log_event_send(message['event'], message['args'], label='Server')
+        self.local_interface.handle(message)
+
+        with self._interest_lock:
+            self._dirty[kind].update(entities.keys())
+
+    def _remove_entities(self, kind, ids):
+        """ The clients are told to forget removed entities in their next delta, only the local player needs telling now. """
+
+        if not ids:
+            return
+
+        event = ENTITY_EVENTS[kind][1]
+        messages = ([{'event': event, 'args': [name]} for name in ids] if kind == 'players' else
+                    [{'event': event, 'args': [list(ids)]}])
+        for message in messages:
+            log_event_send(message['event'], message['args'], label='Server')
+            self.local_interface.handle(message)
+
+    def _entity_sources(self):
+        return {'players': self.game.get_players(self._player_list()), 'mobs': self.game.mobs, 'items': self.game.items}
+
+    def _send_deltas(self):
+        """ Sends each client one delta of what has changed this tick in its view. """
+
+        sources = self._entity_sources()
+        deltas = {}
+
+        with self._interest_lock:
+            dirty, self._dirty = self._dirty, {kind: set() for kind in interest.KINDS}
+
+            for kind in interest.KINDS:
+                source = sources[kind]
+
+                for id_ in set(self._interest.ids(kind)) - source.keys():
+                    for name in self._interest.remove(kind, id_):
+                        self._replication.remove(name, kind, [id_])
+
+                ids = [id_ for id_ in dirty[kind] if id_ in source]
+                for id_ in ids:
+                    self._interest.move(kind, id_, source[id_]['x'])
+                for name, (shown, left) in self._interest.route(kind, ids).items():
+                    if name in self.current_players:
+                        self._replication.show(name, kind, shown)
+                        self._replication.remove(name, kind, left)
+
+            for name in self.current_players:
+                deltas[name] = self._replication.delta(name, sources)
+
+        for name, message in deltas.items():
+            sock = self.current_players.get(name)
+            if message is not None and sock is not None:
+                log_event_send(message['event'], message['args'], label='Server')
+                network.send(sock, message)
+
+    def _update_slices(self, event, *args):
+        """ Sends {x: ...} args to the clients which can see each x's chunk. """
+
+        message = {'event': event, 'args': list(args)}
+        log_event_send(message['event'], message['args'], label='Server')
+        self.local_interface.handle(message)
+
+        xs = {}
+        with self._interest_lock:
+            for x in args[0]:
+                for name in self._interest.subscribers(int(x) // residency.chunk_size):
+                    xs.setdefault(name, []).append(x)
+
+        frames = {}
+        for name, name_xs in xs.items():
+            sock = self.current_players.get(name)
+            if sock is not None:
+                name_message = {'event': event, 'args': [{x: arg[x] for x in name_xs} for arg in args]}
+                self._send_framed(frames, sock, name_message, tuple(name_xs))
+
+    def _sock_name(self, sock):
+        return next((name for name, conn in self.current_players.items() if conn == sock), None)
+
+    def _visible(self, sock, kind, entities):
+        """ The entities the client on sock can see, which it now has. The local player sees everything. """
+
+        name = self._sock_name(sock)
+        if sock is None or name is None:
+            return entities
+
+        with self._interest_lock:
+            self._interest.refresh(name, kind)
+            visible = self._interest.visible(name, kind)
+            if kind == 'players':
+                visible.add(name)
+
+            entities = {id_: entities[id_] for id_ in visible if id_ in entities}
+            for id_, entity in entities.items():
+                self._replication.acknowledge(name, kind, id_, entity)
+
+        return entities
+
     def _player_list(self):
-        return list(self.current_players.keys()) + [self.local_player]
+        players = list(self.current_players.keys())
+        if self.local_player is not None:
+            players.append(self.local_player)
+        return players
 
     def handle(self, sock, data):
         log_event_receive(data['event'], data['args'], label='Server')
 
         result = (
-            {'get_chunks': self.event_get_chunks,
+            {'get_chunks': lambda chunk_list: self.event_get_chunks(chunk_list, sock),
              'set_player': self.event_set_player,
-             'get_players': self.event_get_players,
-             'get_mobs': self.event_get_mobs,
-             'get_items': self.event_get_items,
+             'move_player': lambda *args: self.event_move_player(*args, sock=sock),
+             'get_players': lambda: self.event_get_players(sock),
+             'get_mobs': lambda: self.event_get_mobs(sock),
+             'get_items': lambda: self.event_get_items(sock),
              'set_blocks': self.event_set_blocks,
              'get_time': self.event_get_time,
              'player_attack': self.event_player_attack,
@@ -79,7 +255,8 @@ class Server:
              'respawn': self.event_respawn,
              'logout': lambda: self.event_logout(sock),
              'login': lambda name: self.event_login(name, sock),
-             'unload_slices': self.event_unload_slices
+             'unload_slices': self.event_unload_slices,
+             'resync': lambda: self.event_resync(sock)
              }[data['event']](*data.get('args', []))
         )
 
@@ -97,7 +274,12 @@ class Server:
                 # local_player already contains the local_player name
                 self.current_players[name] = sock
 
-            self._update_clients({'event': 'set_players', 'args': [{name: self.game.get_player(name)}]})
+            player = self.game.get_player(name)
+            self._update_entities('players', {name: player})
+
+            with self._interest_lock:
+                self._replication.acknowledge(name, 'players', name, player)
+            return {'event': 'set_players', 'args': [{name: player}]}
         else:
             log('Not Logging in: ' + name)
             return {'event': 'error', 'args': [{'event': 'login', 'message': 'Username in use'}]}
@@ -105,39 +287,117 @@ class Server:
     def event_logout(self, sock=None):
         # Re-add all players which aren't the sock
         players = {}
-        for name, conn in self.current_players.items():
+        old_players = self.current_players
+        for name, conn in old_players.items():
             if conn == sock:
                 log('Logging out', name, sock)
-                self._update_clients({'event': 'remove_player', 'args': [name]}, name)
+                self.game.remove_view(name)
+                with self._interest_lock:
+                    self._interest.remove_view(name)
+                    self._replication.remove_client(name)
             else:
-                players[name] = sock
+                players[name] = conn
 
         self.current_players = players
+        for name in old_players.keys() - players.keys():
+            self._remove_entities('players', [name])
 
     def event_set_blocks(self, blocks):
-        self._update_clients({'event': 'set_blocks', 'args': [self.game.set_blocks(blocks)]})
-
-    def event_get_chunks(self, chunk_list):
-        return {'event': 'set_chunks', 'args': list(self.game.get_chunks(chunk_list))}
+        self._update_slices('set_blocks', self.game.set_blocks(blocks))
+
+    def event_get_chunks(self, chunk_list, sock=None):
+        """ Starts loading the chunks, they are sent to sock (or the local player) once they're loaded. """
+
+        with self._chunk_requests_lock:
+            for chunk_n in chunk_list:
+                self._chunk_requests.setdefault(chunk_n, []).append(sock)
+
+        self.game.request_chunks(chunk_list)
+
+    def _send_loaded_chunks(self):
+        chunks = self.game.collect_chunks()
+        if not chunks:
+            return
+
+        # Group the chunks by who asked for them, so each gets one message.
+        replies = {}
+        with self._chunk_requests_lock:
+            for chunk_n in chunks:
+                for sock in self._chunk_requests.pop(chunk_n, []):
+                    replies.setdefault(sock, []).append(chunk_n)
+
+        for sock, chunk_list in replies.items():
+            new_slices, new_slice_heights = {}, {}
+            for chunk_n in chunk_list:
+                chunk, chunk_slice_heights = chunks[chunk_n]
+                new_slices.update({x: ''.join(slice_) for x, slice_ in chunk.items()})
+                new_slice_heights.update(chunk_slice_heights)
+
+            message = {'event': 'set_chunks', 'args': [new_slices, new_slice_heights]}
+            log_event_send(message['event'], message['args'], label='Server')
+
+            if sock is None:
+                self.local_interface.handle(message)
+            elif sock in self.current_players.values():
+                network.send(sock, message)
 
     def event_set_player(self, name, player):
         self.game.set_player(name, player)
-        self._update_clients({'event': 'set_players', 'args': [{name: player}]}, exclude=name)
+        self._update_entities('players', {name: self.game.get_player(name)})
+
+        # Don't echo the fields back to the client which set them.
+        if name in self.current_players:
+            with self._interest_lock:
+                self._replication.acknowledge(name, 'players', name, player)
+
+    def event_move_player(self, name, input_seq, dx, dy, sock=None):
+        """ Applies a client's movement input. Moves are relative, so they stay right after the server moves the player. """
 
-    def event_get_players(self):
-        return {'event': 'set_players', 'args': [self.game.get_players(self._player_list())]}
+        # Clients can only move their own player.
+        if sock is None or self.current_players.get(name) != sock:
+            return
 
-    def event_get_mobs(self):
-        return {'event': 'set_mobs', 'args': [self.game.mobs]}
+        with self._interest_lock:
+            player = self.game.get_player(name)
+            if player is None:
+                return
+            player['x'] += dx
+            player['y'] += dy
+            self._replication.ack(name, input_seq)
 
-    def event_get_items(self):
-        return {'event': 'add_items', 'args': [self.game.items]}
+        self.game.changed('players')
+        self._update_entities('players', {name: player})
+
+    def event_get_players(self, sock=None):
+        return {'event': 'set_players', 'args': [self._visible(sock, 'players', self.game.get_players(self._player_list()))]}
+
+    def event_get_mobs(self, sock=None):
+        return {'event': 'set_mobs', 'args': [self._visible(sock, 'mobs', self.game.mobs)]}
+
+    def event_get_items(self, sock=None):
+        return {'event': 'add_items', 'args': [self._visible(sock, 'items', self.game.items)]}
 
     def event_unload_slices(self, name, edges):
         player = self.game.get_player(name)
         player['edges'] = edges
         self.game.set_player(name, player)
-        self.game.reload_slices()
+        self.game.set_view(name, edges)
+
+        # What comes into the client's view is sent in its next delta, and what goes out of it forgotten.
+        with self._interest_lock:
+            self._interest.set_view(name, edges)
+            for kind in interest.KINDS:
+                entered, left = self._interest.refresh(name, kind)
+                if name in self.current_players:
+                    self._replication.show(name, kind, entered)
+                    self._replication.remove(name, kind, left)
+
+    def event_resync(self, sock):
+        name = self._sock_name(sock)
+        if name is not None:
+            log('Resyncing', name)
+            with self._interest_lock:
+                self._replication.reset(name, {kind: self._interest.known(name, kind) for kind in interest.KINDS})
 
     def event_get_time(self):
         return {'event': 'set_time', 'args': [self.game.time]}
@@ -150,26 +410,24 @@ class Server:
         player['inv'] = []
         player['x'], player['y'] = self.game.spawn
         player['health'] = MAX_PLAYER_HEALTH
+        self.game.changed('players', 'items')
 
-        self._update_clients({'event': 'set_players', 'args': [{name: player}]})
+        self._update_entities('players', {name: player})
 
     def event_player_attack(self, name, x, y, radius, strength):
         updated_players, updated_mobs = self.game.player_attack(name, x, y, radius, strength)
-        self._update_clients({'event': 'set_players', 'args': [updated_players]})
-        self._update_clients({'event': 'set_mobs', 'args': [updated_mobs]})
+        self._update_entities('players', updated_players)
+        self._update_entities('mobs', updated_mobs)
 
     def event_splash_damage(self, x, y, radius, strength):
         updated_players, updated_mobs = self.game.splash_damage(x, y, radius, strength)
-        self._update_clients({'event': 'set_players', 'args': [updated_players]})
-        self._update_clients({'event': 'set_mobs', 'args': [updated_mobs]})
+        self._update_entities('players', updated_players)
+        self._update_entities('mobs', updated_mobs)
 
     # Methods for local interface only:
 
     def local_interface_login(self):
-        self._update_clients({
-            'event': 'set_players',
-            'args': [{self.local_player: self.game.get_player(self.local_player)}]
-        })
+        self._update_entities('players', {self.local_player: self.game.get_player(self.local_player)})
 
     def local_interface_init_server(self):
         self.serving = True
@@ -182,6 +440,11 @@ class Server:
 
         self.serving = False
         self._update_clients({'event': 'logout', 'args': ['Server Closed']}, exclude=self.local_player)
+        with self._interest_lock:
+            for name in self.current_players:
+                self._interest.remove_view(name)
+                self._interest.remove('players', name)
+                self._replication.remove_client(name)
         self.current_players = {}
 
         self._stop_server()
@@ -200,29 +463,125 @@ class Server:
     def local_interface_mobs(self):
         return self.game.mobs
 
+    def _tick(self, time):
+        """ Sends out what has changed over the last tick. """
+
+        if time % 100 == 0:
+            self._update_clients({'event': 'set_time', 'args': [time]})
+
+        self._send_deltas()
+
+        new_slices, new_slice_heights = self.game.tick_chunks(self._player_list())
+        if new_slices:
+            self._update_slices('set_chunks', new_slices, new_slice_heights)
+
     def local_interface_dt(self):
+        self._send_loaded_chunks()
+
         dt, time = self.game.dt()
-        if dt and time % 100 == 0:
-            self._update_clients({'event': 'set_time', 'args': [time]})
+        if dt:
+            self._tick(time)
+
         return dt, time
 
+    def local_interface_next_tick(self):
+        return self.game.next_tick
+
+    def local_interface_close(self):
+        self.game.close()
+
     def local_interface_update_mobs(self):
-        updated_players, new_items = self.game.update_mobs()
-        self._update_clients({'event': 'set_players', 'args': [updated_players]})
-        self._update_clients({'event': 'set_mobs', 'args': [self.game.mobs]})
-        self._update_clients({'event': 'add_items', 'args': [new_items]})
+        updated_players, new_items = self.game.update_mobs(self._player_list())
+        self._update_entities('players', updated_players)
+        self._update_entities('mobs', self.game.mobs)
+        self._update_entities('items', new_items)
 
     def local_interface_spawn_mobs(self, *args):
-        self.game.spawn_mobs(*args)
-        self._update_clients({'event': 'set_mobs', 'args': [self.game.mobs]})
+        self.game.spawn_mobs(*args, players=self._player_list())
+        self._update_entities('mobs', self.game.mobs)
 
     def local_interface_update_items(self):
         removed_items = self.game.update_items()
-        self._update_clients({'event': 'remove_items', 'args': [removed_items]})
+        self._remove_entities('items', removed_items)
 
     def local_interface_items(self):
         return self.game.items
 
+    # Headless server:
+
+    def run_headless(self):
+        """
+            Runs the game on its own at timings['tps'], for as long as it is serving.
+            Falling behind, it runs up to MAX_CATCH_UP_TICKS ticks at once, and skips the rest.
+        """
+
+        tick_period = 1 / timings['tps']
+        next_tick = time()
+        spawns = 0
+
+        while self.serving:
+            now = time()
+            if now < next_tick:
+                sleep(next_tick - now)
+                continue
+
+            behind = int((now - next_tick) // tick_period) + 1
+            if behind > MAX_CATCH_UP_TICKS:
+                skipped = behind - MAX_CATCH_UP_TICKS
+                self.skipped_ticks += skipped
+                log('Headless server behind, skipping', skipped, 'ticks,', self.skipped_ticks, 'skipped so far')
+
+                next_tick += skipped * tick_period
+                behind = MAX_CATCH_UP_TICKS
+
+            for _ in range(behind):
+                tick_start = time()
+
+                spawns += HEADLESS_SPAWNS_PER_SECOND * tick_period
+                self._headless_tick(int(spawns))
+                spawns -= int(spawns)
+
+                if time() - tick_start > tick_period:
+                    self.slow_ticks += 1
+                next_tick += tick_period
+
+    def _headless_tick(self, n_mob_spawn_cycles):
+        """ One tick of what the local player's game loop would otherwise drive. """
+
+        self._send_loaded_chunks()
+
+        self.game.step()
+        self._tick(self.game.time)
+
+        self.local_interface_update_items()
+        self.local_interface_update_mobs()
+
+        if n_mob_spawn_cycles:
+            for name in self._player_list():
+                self._spawn_mobs_around(name, n_mob_spawn_cycles)
+            self._update_entities('mobs', self.game.mobs)
+
+    def _spawn_mobs_around(self, name, n_mob_spawn_cycles):
+        """ Spawns mobs around a player, lit as the player would see it. """
+
+        # The player may have logged out since the list was taken.
+        if name not in self._player_list():
+            return
+
+        player = self.game.get_player(name)
+        width = 2 * mobs.spawn_player_range
+        x_start = player['x'] - width // 2
+
+        bk_objects, sky_colour, day = render.bk_objects(self.game.time, width, x_start, self._settings.get('fancy_lights'))
+
+        # Only needed without mobs_c, see Game.spawn_mobs
+        lights = []
+        if mobs.mobs_c is None:
+            view = {x: slice_ for x, slice_ in self.game._map.items() if x_start <= x < x_start + width}
+            lights = render.get_lights(view, bk_objects, player['x'])
+
+        self.game.spawn_mobs(n_mob_spawn_cycles, bk_objects, sky_colour, day, lights, [name])
+
 
 class Game:
     """ The game. """
@@ -231,46 +590,204 @@ class Game:
         self._save = save
         self._map = {}
         self._slice_heights = {}
+
+        # The chunks in _map are the ones a player's view holds, the rest are cached run-length encoded.
+        self._residency = residency.Residency(VIEW_MARGIN_CHUNKS)
+        self._chunk_cache = residency.ChunkCache(settings.get('chunk_cache_mb', 16) * 1024 * 1024)
         self._meta = saves.get_meta(save)
+        self._meta['mobs'] = mobs.new_store(self._meta['mobs'])
+        self._flow_fields = pathfinding.FlowFields()
+        self._spawn_index = mobs.SpawnIndex()
+        self._dirty_records = set()
+        self._last_meta_save = time()
         self._last_tick = time()
         self._settings = settings
+        self._chunkgen = chunkgen.ChunkGenerator(save, self._meta, settings.get('chunk_workers', 0))
+        self._journal = journal.Journal(save)
+
+        # Chunks are read from the save, or generated, on one loader thread.
+        self._loader = ThreadPoolExecutor(1, thread_name_prefix='chunk-loader')
+        self._loading = {}
+        self._loading_lock = Lock()
+
+        # The views change on the network threads, but only the tick thread unloads chunks from the map.
+        self._unloads = set()
+        self._map_lock = Lock()
+
+    def close(self):
+        self._loader.shutdown(wait=True, cancel_futures=True)
+        self._chunkgen.close()
+        self._journal.close()
+        self.save_meta(force=True)
+        saves.close_regions(self._save)
+
+    def request_chunks(self, chunk_list):
+        """ Starts loading the chunks which aren't already loading, for collect_chunks to add to the map. """
+
+        with self._loading_lock:
+            for chunk_n in chunk_list:
+                if chunk_n in self._loading:
+                    continue
+
+                log('loading chunk', chunk_n)
+
+                chunk, chunk_slice_heights = self._inflate_chunk(chunk_n)
+                if chunk:
+                    future = self._loading[chunk_n] = Future()
+                    future.set_result((chunk, chunk_slice_heights))
+                else:
+                    self._loading[chunk_n] = self._loader.submit(self._load_chunk, chunk_n)
+
+    def _load_chunk(self, chunk_n):
+        chunk, chunk_slice_heights = self._journal.load_chunk(chunk_n)
+        if not chunk:
+            chunk, chunk_slice_heights = self._chunkgen.generate(chunk_n)
+
+        return chunk, chunk_slice_heights
+
+    def collect_chunks(self):
+        """ Adds the chunks which have finished loading to the map. Returns {chunk_n: (chunk, slice_heights)}. """
+
+        with self._loading_lock:
+            finished = [(chunk_n, future) for chunk_n, future in self._loading.items() if future.done()]
+            for chunk_n, _ in finished:
+                del self._loading[chunk_n]
+
+        chunks = {}
+        for chunk_n, future in finished:
+            try:
+                chunk, chunk_slice_heights = future.result()
+            except Exception as e:
+                log('Loading chunk failed', chunk_n, e)
+                continue
+
+            # Slices which are already loaded may have been changed since the chunk was read.
+            with self._map_lock:
+                for x, slice_ in chunk.items():
+                    chunk[x] = self._map.setdefault(x, slice_)
+                self._slice_heights.update(chunk_slice_heights)
+
+            chunks[chunk_n] = chunk, chunk_slice_heights
+
+        self._spawn_index.changed(chunks)
+
+        # The players may have moved away while they were loading.
+        with self._map_lock:
+            self._unloads.update(chunks)
+            unloads = [chunk_n for chunk_n in self._unloads if not self._residency.referenced(chunk_n)]
+            self._unloads.clear()
+        self._unload_chunks(unloads)
+
+        return chunks
+
+    def _inflate_chunk(self, chunk_n):
+        """ Returns the chunk from memory if it is still loaded or cached. """
+
+        chunk_size = terrain.world_gen['chunk_size']
+        xs = range(chunk_n * chunk_size, (chunk_n + 1) * chunk_size)
+
+        with self._map_lock:
+            if all(x in self._map for x in xs):
+                return {x: self._map[x] for x in xs}, {x: self._slice_heights[x] for x in xs}
+
+            cached = self._chunk_cache.pop(chunk_n)
+        if cached is None:
+            return {}, {}
 
-    def get_chunks(self, chunk_list):
-        new_slices = {}
-        new_slice_heights = {}
+        columns, slice_heights = cached
+        return ({x: column.to_slice() for x, column in zip(xs, columns)},
+                dict(zip(xs, slice_heights)))
 
-        log('loading chunks', chunk_list)
+    def _unload_chunks(self, chunk_list):
+        """ Moves chunks from the map into the cache. Any edits are already in the journal. Only run on the tick thread. """
 
-        # Generates new terrain
-        for chunk_n in chunk_list:
+        if not chunk_list:
+            return
 
-            chunk, chunk_slice_heights = saves.load_chunk(self._save, chunk_n)
-            if not chunk:
-                chunk, chunk_slice_heights = terrain.gen_chunk(chunk_n, self._meta)
-                saves.save_chunk(self._save, chunk_n, chunk, chunk_slice_heights)
+        self._spawn_index.remove(chunk_list)
 
-            new_slices.update(chunk)
-            new_slice_heights.update(chunk_slice_heights)
+        # Held so no edit lands in a slice after it has been cached.
+        chunk_size = terrain.world_gen['chunk_size']
+        with self._map_lock:
+            for chunk_n in chunk_list:
+                xs = range(chunk_n * chunk_size, (chunk_n + 1) * chunk_size)
+                if all(x in self._map for x in xs):
+                    columns = [rle.RLEColumn.from_slice(self._map[x]) for x in xs]
+                    evicted = self._chunk_cache.put(chunk_n, columns, [self._slice_heights[x] for x in xs])
+                    if evicted:
+                        log('Evicted chunks', evicted, 'cache size', self._chunk_cache.size)
 
-        log('new slices', new_slices.keys())
+            # A new map, as other threads may be iterating over the old one.
+            unloaded = set(chunk_list)
+            self._map = {x: slice_ for x, slice_ in list(self._map.items()) if x // chunk_size not in unloaded}
+            self._slice_heights = {x: h for x, h in list(self._slice_heights.items()) if x // chunk_size not in unloaded}
 
-        self._map.update(new_slices)
-        self._slice_heights.update(new_slice_heights)
+    def set_view(self, name, edges):
+        """ Moves a player's view to the slices in range(*edges). The chunks no view needs are unloaded by collect_chunks. """
+        with self._map_lock:
+            self._unloads.update(self._residency.set_view(name, edges))
+
+    def remove_view(self, name):
+        with self._map_lock:
+            self._unloads.update(self._residency.remove_view(name))
+
+    def tick_chunks(self, players):
+        """
+            Queues the chunks ahead of the players, and publishes the finished
+                ones which are inside a player's loaded edges.
+        """
+
+        players = self.get_players(players)
+        self._chunkgen.prefetch(players)
+
+        new_slices = {}
+        new_slice_heights = {}
+
+        for chunk_n, (chunk, chunk_slice_heights) in self._chunkgen.collect().items():
+            if not self._residency.referenced(chunk_n):
+                continue
+            for x, slice_ in chunk.items():
+                if x not in self._map:
+                    new_slices[x] = slice_
+                    new_slice_heights[x] = chunk_slice_heights[x]
+
+        with self._map_lock:
+            self._map.update(new_slices)
+            self._slice_heights.update(new_slice_heights)
+        self._spawn_index.changed({x // terrain.world_gen['chunk_size'] for x in new_slices})
         return {key: ''.join(value) for key, value in new_slices.items()}, new_slice_heights
 
     def set_blocks(self, blocks):
-        self._map, new_slices = saves.set_blocks(self._map, blocks)
-        saves.save_slices(self._save, new_slices, self._slice_heights)
+        with self._map_lock:
+            _, new_slices = saves.set_blocks(self._map, blocks)
+        # set_blocks ignores edits to slices which aren't loaded.
+        self._journal.record({x: col for x, col in blocks.items() if int(x) in new_slices})
+        self._flow_fields.blocks_changed(blocks)
+        self._spawn_index.blocks_changed(blocks)
         return blocks
 
     def set_player(self, name, player):
         self._meta['players'][name].update(player)
-        saves.save_meta(self._save, self._meta)
+        self.changed('players')
 
     def get_player(self, name):
+        if name not in self._meta['players']:
+            self.changed('players')
         self._meta = saves.load_player(name, self._meta)
         return self._meta['players'][name]
 
+    def changed(self, *records):
+        """ Marks parts of the meta as needing to be saved. """
+        self._dirty_records.update(records)
+
+    def save_meta(self, force=False):
+        """ Saves the changed parts of the meta, at most every META_SAVE_INTERVAL seconds unless forced. """
+
+        if force or time() - self._last_meta_save > META_SAVE_INTERVAL:
+            records, self._dirty_records = self._dirty_records, set()
+            saves.save_meta(self._save, self._meta, records)
+            self._last_meta_save = time()
+
     def get_players(self, players):
         """ Returns player objects """
         return {name: self._meta['players'][name] for name in players}
@@ -283,33 +800,58 @@ class Game:
         self._dt, self._last_tick = dt(self._last_tick)
         self.time += self._dt
 
+        if self._dt:
+            self.save_meta()
+
         return self._dt, self.time
 
-    def reload_slices(self):
-        new_map = {}
-        for x, slice_ in self._map.items():
-            if any(x in range(*player['edges']) for player in self._meta['players'].values() if player.get('edges')):
-                new_map[x] = slice_
-        self._map = new_map
+    def step(self):
+        """ Advances exactly one tick, for running on a fixed timestep rather than with dt(). """
+
+        self._last_tick += 1 / timings['tps']
+        self.time += 1
+        self.save_meta()
+
+    @property
+    def next_tick(self):
+        return self._last_tick + 1 / timings['tps']
 
     def player_attack(self, name, ax, ay, radius, strength):
+        self.changed('players', 'mobs')
         return mobs.calculate_player_attack(name, ax, ay, radius, strength, self._meta['players'], self._meta['mobs'])
 
     def splash_damage(self, dx, dy, radius, strength):
+        self.changed('players', 'mobs')
         return mobs.calculate_player_attack(None, dx, dy, radius, strength, self._meta['players'], self._meta['mobs'])
 
-    def update_mobs(self):
+    def update_mobs(self, players):
+        """ Moves the mobs towards the named players, the ones which are logged in. """
+
         if not self._settings.get('mobs'):
-            self._meta['mobs'].clear()
+            if self._meta['mobs']:
+                self._meta['mobs'].clear()
+                self.changed('mobs')
             return {}, {}
 
-        updated_players, new_items = mobs.update(self._meta['mobs'], self._meta['players'], self._map, self._last_tick)
+        # With nobody to chase, the mobs wait.
+        players = self.get_players(players)
+        if not players:
+            return {}, {}
+
+        self.changed('players', 'mobs', 'items')
+        self._flow_fields.update(players, self._map)
+        updated_players, new_items = mobs.update(self._meta['mobs'], players, self._map, self._last_tick, self._flow_fields)
         self._meta['items'].update(new_items)
         return updated_players, new_items
 
-    def spawn_mobs(self, n_mob_spawn_cycles, bk_objects, sky_colour, day, lights):
+    def spawn_mobs(self, n_mob_spawn_cycles, bk_objects, sky_colour, day, lights, players=None):
+        """ Spawns mobs around the named players, or all of them. """
+
         if self._settings.get('mobs') and n_mob_spawn_cycles != 0:
-            for player in self._meta['players'].values():
+            for name, player in self._meta['players'].items():
+                if players is not None and name not in players:
+                    continue
+
                 px, py = player['x'], player['y']
 
                 width  = 2 * mobs.spawn_player_range
@@ -320,14 +862,26 @@ class Game:
                 x_end = x_start + width
                 y_end = y_start + height
 
-                render_interface.create_lighting_buffer(width, height, x_start, y_start, self._map, self._slice_heights, bk_objects, sky_colour, day, lights)
+                # Wait for the area around the player to load.
+                if not all(x in self._map for x in range(x_start, x_end)):
+                    continue
 
-                for i in range(n_mob_spawn_cycles):
-                    mobs.spawn(self._meta['mobs'], self._meta['players'], self._map, x_start, y_start, x_end, y_end)
+                self.changed('mobs')
+
+                # The spawn index already knows how lit each spot is, without mobs_c it has to be worked out.
+                if mobs.mobs_c is not None:
+                    for i in range(n_mob_spawn_cycles):
+                        mobs.spawn_indexed(self._meta['mobs'], self._meta['players'], self._spawn_index, self._map, self._slice_heights, x_start, y_start, x_end, y_end, day)
+                else:
+                    render_interface.create_lighting_buffer(width, height, x_start, y_start, self._map, self._slice_heights, bk_objects, sky_colour, day, lights)
+                    for i in range(n_mob_spawn_cycles):
+                        mobs.spawn(self._meta['mobs'], self._meta['players'], self._map, x_start, y_start, x_end, y_end)
 
     def update_items(self):
         removed_items = items.pickup_items(self._meta['items'], self._meta['players'])
         removed_items += items.despawn_items(self._meta['items'], self._last_tick)
+        if removed_items:
+            self.changed('players', 'items')
         return removed_items
 
     @property
@@ -349,3 +903,37 @@ class Game:
     @time.setter
     def time(self, time):
         self._meta['tick'] = time
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__.strip().split('\n')[-1].strip())
+        return
+
+    save = sys.argv[1]
+    if not os.path.isdir(saves.save_path(save)):
+        print('No save called', save)
+        return
+
+    port = sys.argv[2] if len(sys.argv) > 2 else 0
+    settings = saves.get_settings()
+
+    # Spawning mobs needs the lighting, but nothing is rendered.
+    render_interface.setup_render_module(settings)
+
+    server = Server(None, save, port, settings, None)
+    server.local_interface_init_server()
+    print('Serving', save, 'on port', server.port)
+
+    try:
+        server.run_headless()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.local_interface_kill_server()
+        server.local_interface_close()
+        print('Skipped', server.skipped_ticks, 'ticks,', server.slow_ticks, 'ran slow')
+
+
+if __name__ == '__main__':
+    main()
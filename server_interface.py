@@ -1,16 +1,21 @@
+import socket
 from threading import Thread, Event
 from math import radians, floor, ceil
-from time import time
+from time import time, sleep
 
 from server import Server, log_event_send, log_event_receive, dt
 from console import log
 from data import timings
 from player import MAX_PLAYER_HEALTH
 
-import saves, terrain, network, mobs
+import saves, terrain, network, mobs, ring
 
 chunk_size = terrain.world_gen['chunk_size']
 
+# Messages received which can wait to be applied, and how many are applied each frame.
+RECEIVE_QUEUE_SIZE = 1024
+EVENTS_PER_FRAME = 32
+
 
 class RemoteInterface:
     """
@@ -29,6 +34,20 @@ class RemoteInterface:
         self.error = None
         self._name = name
 
+        # The last entity delta's sequence number
+        self._delta_seq = 0
+        self._resyncing = False
+
+        # Our moves which the server hasn't acknowledged yet: [(input seq, dx, dy)]
+        self._input_seq = 0
+        self._pending_moves = []
+        # Our position as the server last sent it, and the same with the input it includes, to be applied
+        self._server_pos = None
+        self._correction = None
+
+        # Other players and mobs are drawn moving between their last two positions: {(kind, id): (time, from, to)}
+        self._snapshots = {}
+
         # We cannot serve, we are connected to a server.
         # TODO: Maybe we can do this better...?
         self.serving = None
@@ -43,6 +62,13 @@ class RemoteInterface:
 
         self.finished_login = Event()
 
+        # The listener only decodes messages, they are applied by the main thread in dt().
+        #   It writes to _wake_w after each one, so the main loop can wait on wake_fd.
+        self._received = ring.Ring(RECEIVE_QUEUE_SIZE)
+        self._wake_r, self._wake_w = socket.socketpair()
+        self._wake_r.setblocking(False)
+        self._wake_w.setblocking(False)
+
         self._listener_t = Thread(target=self._listener)
         self._listener_t.daemon = True
         self._listener_t.start()
@@ -51,7 +77,7 @@ class RemoteInterface:
         self._send('login', [self._name])
 
         # Server doesn't respond
-        if not self.finished_login.wait(3):
+        if not self._wait_for_login(3):
             self.error = 'No response from server on login'
             log(self.error)
 
@@ -94,23 +120,67 @@ class RemoteInterface:
                 break
 
             log_event_receive(data['event'], data['args'], label='RemoteInterface')
-
-            {'set_blocks': self._event_set_blocks,
-             'set_chunks': self._event_set_chunks,
-             'set_players': self._event_set_players,
-             'remove_player': self._event_remove_player,
-             'set_mobs': self._event_set_mobs,
-             'set_items': self._event_set_items,
-             'add_items': self._event_add_items,
-             'remove_items': self._event_remove_items,
-             'set_time': self._event_set_time,
-             'logout': self._event_logout,
-             'error': self._event_error
-             }[data['event']](*data.get('args', []))
+            self._received.put(data)
+            self._wake()
 
             if data['event'] == 'error':
                 break
 
+    def _wake(self):
+        try:
+            self._wake_w.send(b'\0')
+        except BlockingIOError:
+            # Already woken
+            pass
+
+    def _apply_events(self, budget=None):
+        """ Applies up to budget of the messages the listener has received, all of them if budget is None. """
+
+        try:
+            while self._wake_r.recv(4096):
+                pass
+        except BlockingIOError:
+            pass
+
+        handlers = {
+            'set_blocks': self._event_set_blocks,
+            'set_chunks': self._event_set_chunks,
+            'set_players': self._event_set_players,
+            'remove_player': self._event_remove_player,
+            'set_mobs': self._event_set_mobs,
+            'remove_mobs': self._event_remove_mobs,
+            'set_items': self._event_set_items,
+            'add_items': self._event_add_items,
+            'remove_items': self._event_remove_items,
+            'entity_delta': self._event_entity_delta,
+            'set_time': self._event_set_time,
+            'logout': self._event_logout,
+            'error': self._event_error
+        }
+
+        n = 0
+        while budget is None or n < budget:
+            data = self._received.pop()
+            if data is None:
+                break
+
+            handlers[data['event']](*data.get('args', []))
+            n += 1
+
+        # Wake the next frame for the rest.
+        if len(self._received):
+            self._wake()
+
+    def _wait_for_login(self, timeout):
+        """ Applies messages as they arrive until the server accepts or refuses the login. """
+
+        end = time() + timeout
+        while not self.finished_login.is_set() and time() < end:
+            self._apply_events()
+            sleep(0.01)
+
+        return self.finished_login.is_set()
+
     # Handler network request methods:
 
     def _event_set_blocks(self, blocks):
@@ -128,17 +198,25 @@ class RemoteInterface:
         self.current_players.update(players)
         self.redraw = True
 
+        if self._name in players:
+            self._server_pos = players[self._name]['x'], players[self._name]['y']
+
         # TODO: Move the login checks out of this method
         if self._name in players and not self.finished_login.is_set():
             log('FINISHED LOGIN')
             self.finished_login.set()
 
     def _event_remove_player(self, name):
-        self.current_players.pop(name)
+        self.current_players.pop(name, None)
         self.redraw = True
 
     def _event_set_mobs(self, mobs):
-        self.mobs = mobs
+        # The server only sends the mobs which have changed, and that we can see.
+        self.mobs.update(mobs)
+        self.redraw = True
+
+    def _event_remove_mobs(self, removed_mobs):
+        self.mobs = {id_: mob for id_, mob in self.mobs.items() if id_ not in removed_mobs}
         self.redraw = True
 
     def _event_set_items(self, items):
@@ -153,6 +231,91 @@ class RemoteInterface:
         self.items = {id_: item for id_, item in self.items.items() if id_ not in removed_items}
         self.redraw = True
 
+    def _event_entity_delta(self, seq, ack, full, changes, removed):
+        if full:
+            self._resyncing = False
+        elif seq != self._delta_seq + 1 and not self._resyncing:
+            # The server skipped a delta because we were behind, so we need everything again.
+            log('Missed deltas', self._delta_seq + 1, 'to', seq - 1, 'resyncing')
+            self._resyncing = True
+            self._send('resync')
+        self._delta_seq = seq
+
+        for kind, entities in (('players', self.current_players), ('mobs', self.mobs), ('items', self.items)):
+            if full:
+                for id_ in entities.keys() - changes.get(kind, {}).keys() - {self._name}:
+                    del entities[id_]
+
+            for id_, fields in changes.get(kind, {}).items():
+                moved = 'x' in fields or 'y' in fields
+
+                if kind == 'players' and id_ == self._name and moved:
+                    # Our position is predicted, the server's is applied in _reconcile.
+                    fields = dict(fields)
+                    self._server_pos = (fields.pop('x', self._server_pos[0]), fields.pop('y', self._server_pos[1]))
+                    self._correction = (ack,) + self._server_pos
+
+                elif kind != 'items' and id_ in entities and moved:
+                    fields = dict(fields)
+                    self._snapshot(kind, id_, entities[id_], fields.pop('x', None), fields.pop('y', None))
+
+                entities.setdefault(id_, {}).update(fields)
+
+            for id_ in removed.get(kind, []):
+                entities.pop(id_, None)
+
+        if self._correction is None:
+            self._correction = (ack, None, None)
+
+        self.redraw = True
+
+    def _snapshot(self, kind, id_, entity, x, y):
+        """ Starts an entity moving from its last position to the new one. """
+
+        last = self._snapshots.get((kind, id_))
+        from_ = last[2] if last is not None else (entity['x'], entity['y'])
+        to = (from_[0] if x is None else x, from_[1] if y is None else y)
+
+        self._snapshots[kind, id_] = (time(), from_, to)
+
+    def _interpolate(self):
+        """ Moves the other players and mobs along, reaching their last position a tick after it was sent. """
+
+        now = time()
+        for key, snapshot in list(self._snapshots.items()):
+            kind, id_ = key
+            t0, from_, to = snapshot
+            entity = (self.current_players if kind == 'players' else self.mobs).get(id_)
+
+            t = min(1, (now - t0) * timings['tps'])
+            if entity is not None:
+                entity['x'] = round(from_[0] + (to[0] - from_[0]) * t)
+                entity['y'] = round(from_[1] + (to[1] - from_[1]) * t)
+                self.redraw = True
+
+            if (t == 1 or entity is None) and self._snapshots.get(key) is snapshot:
+                del self._snapshots[key]
+
+    def _reconcile(self):
+        """ Drops the moves the server has acknowledged, and if it sent our position, replays the rest on top of it. """
+
+        correction, self._correction = self._correction, None
+        if correction is None:
+            return
+
+        ack, x, y = correction
+        self._pending_moves = [move for move in self._pending_moves if move[0] > ack]
+
+        if x is not None:
+            for _, dx, dy in self._pending_moves:
+                x += dx
+                y += dy
+
+            player = self.current_players[self._name]
+            if (player['x'], player['y']) != (x, y):
+                player['x'], player['y'] = x, y
+                self.redraw = True
+
     def _event_set_time(self, time):
         self.time = time
 
@@ -163,7 +326,7 @@ class RemoteInterface:
             self.error = error
 
         try:
-            self._sock.close()
+            network.close(self._sock)
         except OSError:
             pass
 
@@ -177,13 +340,10 @@ class RemoteInterface:
     # Main loop methods:
 
     def get_chunks(self, chunk_list):
-        slices_its_loading = [(chunk_num + chunk * chunk_size) for chunk in chunk_list for chunk_num in range(chunk_size)]
-
-        self.map_.update({i: list(terrain.EMPTY_SLICE) for i in slices_its_loading})
-        self.slice_heights.update({i: terrain.world_gen['ground_height'] for i in slices_its_loading})
-        self._send('get_chunks', [chunk_list])
-        self._chunks_requested.update(chunk_list)
-        self.view_change = True
+        chunk_list = [chunk_n for chunk_n in chunk_list if chunk_n not in self._chunks_requested]
+        if chunk_list:
+            self._send('get_chunks', [chunk_list])
+            self._chunks_requested.update(chunk_list)
 
     def chunk_loaded(self, x):
         return (x // terrain.world_gen['chunk_size']) not in self._chunks_requested
@@ -206,11 +366,23 @@ class RemoteInterface:
         self._event_logout()
 
     def dt(self):
+        self._apply_events(EVENTS_PER_FRAME)
+        self._interpolate()
+
         self._dt, self._last_tick = dt(self._last_tick)
         self.time += self._dt
 
         return self._dt
 
+    @property
+    def next_tick(self):
+        return self._last_tick + 1 / timings['tps']
+
+    @property
+    def wake_fd(self):
+        """ Readable when there are received messages to apply. """
+        return self._wake_r
+
     def update_mobs(self):
         # The client does nothing
         pass
@@ -237,10 +409,11 @@ class RemoteInterface:
         new_health = self.current_players[self._name]['health'] + dhealth
         self.current_players[self._name]['health'] = min(MAX_PLAYER_HEALTH, new_health)
 
-        self._send('set_player', [self._name, self.current_players[self._name]])
+        self._send('set_player', [self._name, {'health': self.current_players[self._name]['health']}])
 
     @property
     def pos(self):
+        self._reconcile()
         return self.current_players[self._name]['x'], self.current_players[self._name]['y']
 
     @property
@@ -253,13 +426,19 @@ class RemoteInterface:
 
     @pos.setter
     def pos(self, pos):
-        self.current_players[self._name]['x'], self.current_players[self._name]['y'] = pos
-        self._send('set_player', [self._name, self.current_players[self._name]])
+        # Moved now, and sent as an input for the server to acknowledge.
+        player = self.current_players[self._name]
+        dx, dy = pos[0] - player['x'], pos[1] - player['y']
+        player['x'], player['y'] = pos
+
+        self._input_seq += 1
+        self._pending_moves.append((self._input_seq, dx, dy))
+        self._send('move_player', [self._name, self._input_seq, dx, dy])
 
     @inv.setter
     def inv(self, inv):
         self.current_players[self._name]['inv'] = inv
-        self._send('set_player', [self._name, self.current_players[self._name]])
+        self._send('set_player', [self._name, {'inv': inv}])
 
     # TODO: do the pause stuff
     def pause(self, paused):
@@ -280,6 +459,7 @@ class LocalInterface:
         self.time = timings['tick']
         self._name = name
         self.current_players = {}
+        self.view_change = False
         self._server = Server(name, save, port, settings, self)
         self._server.local_interface_login()
 
@@ -295,6 +475,7 @@ class LocalInterface:
          'set_players': self._event_set_players,
          'remove_player': self._event_remove_player,
          'set_mobs': self._event_set_mobs,
+         'remove_mobs': self._event_remove_mobs,
          'set_items': self._event_set_items,
          'add_items': self._event_add_items,
          'remove_items': self._event_remove_items,
@@ -313,12 +494,15 @@ class LocalInterface:
         self.redraw = True
 
     def _event_remove_player(self, name):
-        self.current_players.pop(name)
+        self.current_players.pop(name, None)
         self.redraw = True
 
     def _event_set_mobs(self, mobs):
         self.redraw = True
 
+    def _event_remove_mobs(self, removed_mobs):
+        self.redraw = True
+
     def _event_set_items(self, items):
         self.redraw = True
 
@@ -344,13 +528,10 @@ class LocalInterface:
     # Main loop methods:
 
     def get_chunks(self, chunk_list):
-        slices_its_loading = ((chunk_num + chunk * chunk_size) for chunk in chunk_list for chunk_num in range(chunk_size))
-
-        self.handle(self._send('get_chunks', [chunk_list]))
-        self.view_change = True
+        self._send('get_chunks', [chunk_list])
 
     def chunk_loaded(self, x):
-        return True
+        return x in self.map_
 
     def unload_slices(self, edges):
         edges = [chunk_size * floor(edges[0] / chunk_size),
@@ -363,6 +544,7 @@ class LocalInterface:
     def logout(self):
         if self.serving:
             self.kill_server()
+        self._server.local_interface_close()
         self._event_logout()
 
     def init_server(self):
@@ -377,6 +559,15 @@ class LocalInterface:
         dt, self.time = self._server.local_interface_dt()
         return dt
 
+    @property
+    def next_tick(self):
+        return self._server.local_interface_next_tick()
+
+    @property
+    def wake_fd(self):
+        # Everything is applied as it happens.
+        return None
+
     def update_mobs(self):
         self._server.local_interface_update_mobs()
 
@@ -400,7 +591,7 @@ class LocalInterface:
         new_health = self.current_players[self._name]['health'] + dhealth
         self.current_players[self._name]['health'] = min(MAX_PLAYER_HEALTH, new_health)
 
-        self._send('set_player', [self._name, self.current_players[self._name]])
+        self._send('set_player', [self._name, {'health': self.current_players[self._name]['health']}])
 
     @property
     def pos(self):
@@ -413,7 +604,7 @@ class LocalInterface:
     @pos.setter
     def pos(self, pos):
         self.current_players[self._name]['x'], self.current_players[self._name]['y'] = pos
-        self._send('set_player', [self._name, self.current_players[self._name]])
+        self._send('set_player', [self._name, {'x': pos[0], 'y': pos[1]}])
 
     @inv.setter
     def inv(self, inv):
@@ -4,4 +4,11 @@ import translate_data
 with open('data.c', 'w') as data_file:
 	print(translate_data.translate(), file=data_file)
 
-setup(ext_modules=[Extension('render_c', sources=['render_c_module.c'])])
+with open('lighting.c', 'w') as lighting_file:
+	print(translate_data.translate_lighting(), file=lighting_file)
+
+setup(ext_modules=[
+	Extension('render_c', sources=['render_c_module.c']),
+	Extension('terrain_c', sources=['terrain_c_module.c']),
+	Extension('mobs_c', sources=['mobs_c_module.c'])
+])
@@ -1,9 +1,16 @@
 import random
-from collections import OrderedDict
+from collections import OrderedDict, namedtuple
 from math import ceil, cos, sin, radians, atan2
 
 from data import world_gen, blocks
 from console import log, DEBUG
+import hashrandom
+
+
+# Saves created before world_gen_version was added are version 1, which
+#   reseeds the global Mersenne Twister for every feature. Version 2 uses the
+#   hashrandom counter-based generator.
+WORLD_GEN_VERSION = 2
 
 
 # Maximum width of half a tree
@@ -19,12 +26,23 @@ get_chunk_list = lambda slice_list: list(set(int(i) // world_gen['chunk_size'] f
 MAX_HILL_RAD = world_gen['max_hill'] * world_gen['min_grad']
 
 
-def move_map(map_, edges):
-    # Create subset of slices from map_ between edges
+def move_map(map_, slice_heights, edges):
+    # Create subset of slices from map_ between edges, with blank slices where they haven't loaded yet
     slices = {}
+    heights = {}
     for pos in range(*edges):
-        slices[pos] = map_[pos]
-    return slices
+        if pos in map_:
+            slices[pos] = map_[pos]
+            heights[pos] = slice_heights[pos]
+        else:
+            slices[pos] = EMPTY_SLICE
+            heights[pos] = world_gen['ground_height']
+    return slices, heights
+
+
+def slices_loaded(map_, x, reach=2):
+    """ Whether the slices within reach of x, which the player can move into or use, have loaded. """
+    return all(x + dx in map_ for dx in range(-reach, reach + 1))
 
 
 def detect_edges(map_, edges):
@@ -99,275 +117,295 @@ def in_chunk(pos, chunk_pos):
     return chunk_pos <= pos < chunk_pos + world_gen['chunk_size']
 
 
-class TerrainCache(OrderedDict):
-    """ Implements a Dict with a size limit.
-        Beyond which it replaces the oldest item. """
+# Feature records. x is the column the feature is rooted at.
+Biome = namedtuple('Biome', 'x type radius')
+Hill = namedtuple('Hill', 'x gradient_l gradient_r height')
+Tree = namedtuple('Tree', 'x type trunk_depth height')
+Ore = namedtuple('Ore', 'x name root_height vain_shape')
+Grass = namedtuple('Grass', 'x y')
+CaveAir = namedtuple('CaveAir', 'x rows')
+Cave = namedtuple('Cave', 'x carved')
 
-    def __init__(self, *args, **kwds):
-        self._limit = kwds.pop("limit", None)
-        OrderedDict.__init__(self, *args, **kwds)
-        self._check_limit()
+CAVE_Y_RES = 2  # Double the y resolution of the CA to correct for aspect ratio
+CA_ITERATIONS = 6
 
-    def __setitem__(self, key, value):
-        OrderedDict.__setitem__(self, key, value)
-        self._check_limit()
+# How far outside a chunk the ground heights and biomes are needed to build
+#   the features which overlap it.
+FEATURE_MARGIN = max(MAX_HALF_TREE, CA_ITERATIONS, *MAX_ORE_RANGE)
 
-    def _check_limit(self):
-        if self._limit is not None:
-            while len(self) > self._limit:
-                self.popitem(last=False)
-
-
-# TODO: This probably shouldn't stay here...
-features = None
-def init_features():
-    global features
-    cache_size = (world_gen['max_biome'] * 4) + world_gen['chunk_size']
-    features = TerrainCache(limit=cache_size)
+# The furthest a chunk's features reach, in chunks.
+MAX_FEATURE_REACH = ceil((FEATURE_MARGIN + max(MAX_HILL_RAD, world_gen['max_biome'])) / world_gen['chunk_size'])
 
-init_features()
 
+class FeatureStore:
+    """
+        Holds the generated features for each chunk, by type, so generating a
+            chunk only has to look at the chunks its features can reach.
 
-# # TODO: Use this for the other functions!
-# def gen_features(generator, features, feature_group_name, chunk_pos, meta):
-#     """ Ensures the features within `range` exist in `features` """
+        Each type is a dict of x -> record, with None recording that there is
+            no feature at x. Only the most recently used `limit` chunks are
+            kept, as features can always be regenerated.
+    """
 
-#     feature_cache = features[feature_group_name]
+    def __init__(self, limit):
+        self._limit = limit
+        self._chunks = OrderedDict()
 
-#     for x in range(chunk_pos - RAD, chunk_pos + world_gen['chunk_size'] + RAD):
-#         if feature_cache.get(chunk_pos) is None:
+    def __len__(self):
+        return len(self._chunks)
 
-#             # Init to empty, so 'no features' is cached.
-#             feature_cache[chunk_pos] = {}
+    def _chunk(self, chunk_n):
+        chunk = self._chunks.get(chunk_n)
 
-#             random.seed(str(meta['seed']) + str(chunk_pos) + feature_group_name)
-#             feature_cache[chunk_pos]['biome'] = generator()
+        if chunk is None:
+            chunk = self._chunks[chunk_n] = {}
+            while len(self._chunks) > self._limit:
+                self._chunks.popitem(last=False)
+        else:
+            self._chunks.move_to_end(chunk_n)
 
+        return chunk
 
-def gen_biome_features(features, chunk_pos, meta):
-    for x in range(chunk_pos - world_gen['max_biome'], chunk_pos + world_gen['chunk_size'] + world_gen['max_biome']):
+    def _buckets(self, type_, x_min, x_max):
+        """ Yields (bucket, x range) for each chunk overlapping x_min to x_max. """
 
-        # TODO: Each of these `if` blocks should be abstracted into a function
-        #         which just returns the `attrs` object.
+        chunk_size = world_gen['chunk_size']
+        for chunk_n in range(x_min // chunk_size, (x_max - 1) // chunk_size + 1):
+            chunk_pos = chunk_n * chunk_size
+            bucket = self._chunk(chunk_n).setdefault(type_, {})
+            yield bucket, range(max(x_min, chunk_pos), min(x_max, chunk_pos + chunk_size))
 
-        if features.get(x) is None:
-            # Init to empty, so 'no features' is cached.
-            features[x] = {}
+    def ensure(self, type_, x_min, x_max, generator):
+        """ Generates the features of type_ between x_min and x_max which haven't been yet. """
 
-        # If it is not None, it has all ready been generated.
-        if features[x].get('biome') is None:
+        for bucket, xs in self._buckets(type_, x_min, x_max):
+            for x in xs:
+                if x not in bucket:
+                    bucket[x] = generator(x)
 
-            random.seed(str(meta['seed']) + str(x) + 'biome')
-            if random.random() <= 0.05:
+    def query(self, type_, x_min, x_max):
+        """ Yields the features of type_ rooted between x_min and x_max. """
 
-                # TODO: Move outside function
-                biomes_population = []
-                for name, data in world_gen['biomes'].items():
-                    biomes_population.extend([name] * int(data['chance'] * 100))
+        for bucket, xs in self._buckets(type_, x_min, x_max):
+            for x in xs:
+                feature = bucket.get(x)
+                if feature is not None:
+                    yield feature
 
-                attrs = {}
-                attrs['type'] = random.choice(sorted(biomes_population))
-                attrs['radius'] = random.randint(world_gen['min_biome'], world_gen['max_biome'])
+    def get(self, type_, x):
+        return self._chunk(x // world_gen['chunk_size']).get(type_, {}).get(x)
 
-                features[x]['biome'] = attrs
 
+class TerrainCache(OrderedDict):
+    """ Implements a Dict with a size limit.
+        Beyond which it replaces the oldest item. """
 
-def gen_hill_features(features, chunk_pos, meta):
-    for x in range(chunk_pos - MAX_HILL_RAD, chunk_pos + world_gen['chunk_size'] + MAX_HILL_RAD):
+    def __init__(self, *args, **kwds):
+        self._limit = kwds.pop("limit", None)
+        OrderedDict.__init__(self, *args, **kwds)
+        self._check_limit()
 
-        # TODO: Each of these `if` blocks should be abstracted into a function
-        #         which just returns the `attrs` object.
+    def __setitem__(self, key, value):
+        OrderedDict.__setitem__(self, key, value)
+        self._check_limit()
 
-        if features.get(x) is None:
-            # Init to empty, so 'no features' is cached.
-            features[x] = {}
+    def _check_limit(self):
+        if self._limit is not None:
+            while len(self) > self._limit:
+                self.popitem(last=False)
 
-        # If it is not None, it has all ready been generated.
-        if features[x].get('hill') is None:
 
-            random.seed(str(meta['seed']) + str(x) + 'hill')
-            if random.random() <= 0.05:
+# TODO: This probably shouldn't stay here...
+features = None
+features_v1 = None
+def init_features():
+    global features, features_v1
+    # Room for the reach of a couple of chunks either side, so walking back
+    #   and forth doesn't regenerate anything.
+    features = FeatureStore(limit=(MAX_FEATURE_REACH + 2) * 2 + 1)
+    # x -> {name: record}, for version 1 saves, see gen_chunk_v1.
+    features_v1 = TerrainCache(limit=(world_gen['max_biome'] * 4) + world_gen['chunk_size'])
 
-                attrs = {}
-                attrs['gradient_l'] = random.randint(1, world_gen['min_grad'])
-                attrs['gradient_r'] = random.randint(1, world_gen['min_grad'])
-                attrs['height'] = random.randint(0, world_gen['max_hill'])
+init_features()
 
-                features[x]['hill'] = attrs
 
+def feature_random(meta, x, name):
+    """ Returns the random number generator for the feature `name` at x. """
 
-def gen_tree_features(features, ground_heights, slices_biome, chunk_pos, meta):
-    for x in range(chunk_pos - MAX_HALF_TREE, chunk_pos + world_gen['chunk_size'] + MAX_HALF_TREE):
+    if meta.get('world_gen_version', 1) < 2:
+        random.seed(str(meta['seed']) + str(x) + name)
+        return random
 
-        # TODO: Each of these `if` blocks should be abstracted into a function
-        #         which just returns the `attrs` object.
+    return hashrandom.HashRandom(hashrandom.string_key(meta['seed']), x, hashrandom.string_key(name))
 
-        if features.get(x) is None:
-            # Init to empty, so 'no features' is cached.
-            features[x] = {}
 
-        # If it is not None, it has all ready been generated.
-        if features[x].get('tree') is None:
+biomes_population = []
+for name, data in world_gen['biomes'].items():
+    biomes_population.extend([name] * int(data['chance'] * 100))
+biomes_population.sort()
 
-            biome_data = world_gen['biomes'][slices_biome[x][0]]
-            boime_tree_chance = biome_data['trees']
 
-            random.seed(str(meta['seed']) + str(x) + 'tree')
-            type_ = random.randint(0, len(world_gen['trees'])-1)
-            tree_data = world_gen['trees'][type_]
+def gen_biome_feature(x, meta):
+    rng = feature_random(meta, x, 'biome')
+    if rng.random() <= 0.05:
+        return Biome(
+            x=x,
+            type=rng.choice(biomes_population),
+            radius=rng.randint(world_gen['min_biome'], world_gen['max_biome'])
+        )
 
-            tree_chance = boime_tree_chance * tree_data['chance']
 
-            if random.random() <= tree_chance:
+def gen_hill_feature(x, meta):
+    rng = feature_random(meta, x, 'hill')
+    if rng.random() <= 0.05:
+        return Hill(
+            x=x,
+            gradient_l=rng.randint(1, world_gen['min_grad']),
+            gradient_r=rng.randint(1, world_gen['min_grad']),
+            height=rng.randint(0, world_gen['max_hill'])
+        )
 
-                attrs = {}
-                attrs['type'] = type_
 
-                leaves = tree_data['leaves']
+def gen_tree_feature(x, ground_heights, slices_biome, meta):
+    biome_data = world_gen['biomes'][slices_biome[x][0]]
+    boime_tree_chance = biome_data['trees']
 
-                # Centre tree slice (contains trunk)
-                # TODO: This calculation could be done on start-up, and stored
-                #         with each tree type.
-                center_leaves = leaves[int(len(leaves) / 2)]
-                if 1 in center_leaves:
-                    attrs['trunk_depth'] = center_leaves[::-1].index(1)
-                else:
-                    attrs['trunk_depth'] = len(center_leaves)
+    rng = feature_random(meta, x, 'tree')
+    type_ = rng.randint(0, len(world_gen['trees'])-1)
+    tree_data = world_gen['trees'][type_]
 
-                # Get space above ground
-                air_height = world_gen['height'] - ground_heights[x]
-                tree_height = air_height - (len(center_leaves) - attrs['trunk_depth'])
-                tree_height = min(tree_height, tree_data['min_height'])
+    tree_chance = boime_tree_chance * tree_data['chance']
 
-                attrs['height'] = random.randint(tree_data['min_height'], max(tree_height, 2))
+    if rng.random() <= tree_chance:
 
-                features[x]['tree'] = attrs
+        leaves = tree_data['leaves']
 
+        # Centre tree slice (contains trunk)
+        # TODO: This calculation could be done on start-up, and stored
+        #         with each tree type.
+        center_leaves = leaves[int(len(leaves) / 2)]
+        if 1 in center_leaves:
+            trunk_depth = center_leaves[::-1].index(1)
+        else:
+            trunk_depth = len(center_leaves)
 
-def gen_ore_features(features, ground_heights, slices_biome, chunk_pos, meta):
-    for x in range(chunk_pos - MAX_ORE_RANGE[0], chunk_pos + world_gen['chunk_size'] + MAX_ORE_RANGE[1]):
+        # Get space above ground
+        air_height = world_gen['height'] - ground_heights[x]
+        tree_height = air_height - (len(center_leaves) - trunk_depth)
+        tree_height = min(tree_height, tree_data['min_height'])
+
+        return Tree(
+            x=x,
+            type=type_,
+            trunk_depth=trunk_depth,
+            height=rng.randint(tree_data['min_height'], max(tree_height, 2))
+        )
 
-        # TODO: Each of these `if` blocks should be abstracted into a function
-        #         which just returns the `attrs` object.
 
-        if features.get(x) is None:
-            # Init to empty, so 'no features' is cached.
-            features[x] = {}
+def gen_ore_feature(x, name, ore, ground_heights, meta):
+    rng = feature_random(meta, x, name + '_ore_root')
+    if rng.random() <= ore['chance']:
 
-        # Ores
-        # NOTE: Ores seem to be the way to model the generalization of the
-        #         rest of the features after
-        for name, ore in world_gen['ores'].items():
-            feature_name = name + '_ore_root'
+        upper = int(world_gen['height'] * ore['upper'])
+        lower = int(world_gen['height'] * ore['lower'])
 
-            # If it is not None, it has all ready been generated.
-            if features[x].get(feature_name) is None:
+        root_height = world_gen['height'] - rng.randint(
+            lower, min(upper, (ground_heights[x] - 1))  # -1 for grass.
+        )
 
-                random.seed(str(meta['seed']) + str(x) + feature_name)
-                if random.random() <= ore['chance']:
+        # Generates ore at random position around root ore
+        pot_vain_blocks = ore['vain_size'] ** 2
 
-                    upper = int(world_gen['height'] * ore['upper'])
-                    lower = int(world_gen['height'] * ore['lower'])
+        # Describes the shape of the vain,
+        #   top to bottom, left to right.
+        vain_shape = [b / 100 for b in rng.sample(range(0, 100), pot_vain_blocks)]
 
-                    attrs = {}
-                    attrs['root_height'] = world_gen['height'] - random.randint(
-                        lower, min(upper, (ground_heights[x] - 1))  # -1 for grass.
-                    )
+        return Ore(x=x, name=name, root_height=root_height, vain_shape=vain_shape)
 
-                    # Generates ore at random position around root ore
-                    pot_vain_blocks = ore['vain_size'] ** 2
 
-                    # Describes the shape of the vain,
-                    #   top to bottom, left to right.
-                    attrs['vain_shape'] = [b / 100 for b in random.sample(range(0, 100), pot_vain_blocks)]
+def gen_grass_feature(x, ground_heights, slices_biome, meta):
+    biome_data = world_gen['biomes'][slices_biome[x][0]]
+    grass_chance = biome_data['grass']
 
-                    features[x][feature_name] = attrs
+    rng = feature_random(meta, x, 'grass')
+    if rng.random() <= grass_chance:
+        return Grass(x=x, y=ground_heights[x])
 
 
-def gen_grass_features(features, ground_heights, slices_biome, chunk_pos, meta):
-    for x in range(chunk_pos, chunk_pos + world_gen['chunk_size']):
+def gen_cave_air_feature(x, ground_heights, meta):
+    """ The initial air points for x, as rows of the CA grid counting down from the surface. """
 
-        # TODO: Each of these `if` blocks should be abstracted into a function
-        #         which just returns the `attrs` object.
+    n_rows = CAVE_Y_RES * (ground_heights[x] - 2)
 
-        if features.get(x) is None:
-            # Init to empty, so 'no features' is cached.
-            features[x] = {}
+    if meta.get('world_gen_version', 1) < 2:
+        rng = feature_random(meta, x, 'cave')
+        air_rows = [y for y in range(n_rows) if rng.random() < world_gen['cave_chance']]
+    else:
+        air_rows = hashrandom.threshold_column(hashrandom.string_key(meta['seed']), x,
+            hashrandom.string_key('cave'), n_rows, world_gen['cave_chance'])
 
-        # If it is not None, it has all ready been generated.
-        if features[x].get('grass') is None:
+    return CaveAir(x=x, rows=air_rows)
 
-            biome_data = world_gen['biomes'][slices_biome[x][0]]
-            grass_chance = biome_data['grass']
 
-            random.seed(str(meta['seed']) + str(x) + 'grass')
-            if random.random() <= grass_chance:
+def cave_automaton(x_min, row_counts, initial_rows, iterations, height, y_res):
+    """
+        Runs the cave cellular automaton over the columns starting at x_min.
+            Column x has row_counts[x] rows, of which initial_rows[x] start as
+            air. Returns {x: [y, ...]} of the blocks which end up carved out.
 
-                attrs = {}
-                attrs['y'] = ground_heights[x]
+        Uses terrain_c, which packs the rows into bits, if it is available.
+    """
 
-                features[x]['grass'] = attrs
+    if hashrandom.terrain_c is not None:
+        return hashrandom.terrain_c.cave_automaton(x_min, row_counts, initial_rows, iterations, height, y_res)
+    else:
+        return cave_automaton_py(x_min, row_counts, initial_rows, iterations, height, y_res)
 
 
-def gen_cave_features(features, ground_heights, slices_biome, chunk_pos, meta):
+def cave_automaton_py(x_min, row_counts, initial_rows, iterations, height, y_res):
+    """ The Python cave automaton, and the reference for terrain_c.cave_automaton. """
 
-    cave_y_res = 2  # Double the y resolution of the CA to correct for aspect ratio
-    ca_iterations = 6
+    column_ys = [[height - (y/y_res) - 2 for y in range(n_rows)] for n_rows in row_counts]
+    offsets = [(nx, ny) for nx in (-1, 0, 1) for ny in (-(1/y_res), 0, (1/y_res))]
 
     air_points = set()
-    air_points_x_min = chunk_pos - ca_iterations
-    air_points_x_max = chunk_pos + world_gen['chunk_size'] + ca_iterations
-
-    for x in range(air_points_x_min, air_points_x_max):
-
-        # TODO: Each of these `if` blocks should be abstracted into a function
-        #         which just returns the `attrs` object.
-
-        if features.get(x) is None:
-            # Init to empty, so 'no features' is cached.
-            features[x] = {}
-
-        # If it is not None, it has all ready been generated.
-        if features[x].get('cave_initial_air_points') is None:
-            random.seed(str(meta['seed']) + str(x) + 'cave')
+    for dx, rows in enumerate(initial_rows):
+        air_points.update((x_min + dx, column_ys[dx][y]) for y in rows if y < row_counts[dx])
 
-            # Generate air points for this slice
-            slice_air_points = set()
-            for y in range(cave_y_res * (ground_heights[x] - 2)):
-                world_y = world_gen['height'] - (y/cave_y_res) - 2
+    for i in range(iterations):
+        new_air_points = set()
 
-                if random.random() < world_gen['cave_chance']:
-                    slice_air_points.add((x, world_y))
+        for dx, ys in enumerate(column_ys):
+            x = x_min + dx
+            for world_y in ys:
 
-            if slice_air_points:
-                features[x]['cave_initial_air_points'] = slice_air_points
+                n_neighbours = 0
+                for nx, ny in offsets:
+                    if (x + nx, world_y + ny) in air_points:
+                        n_neighbours += 1
 
-        # Store slice air points in our local collection of air points for CA generation
-        if features[x].get('cave_initial_air_points'):
-            air_points = air_points.union(features[x]['cave_initial_air_points'])
+                if n_neighbours < 5:
+                    new_air_points.add((x, world_y))
 
-    if features[chunk_pos].get('cave') is None:
-        # Perform cellular automata
-        for i in range(ca_iterations):
-            new_air_points = set()
+        air_points = new_air_points
 
-            for x in range(air_points_x_min, air_points_x_max):
-                for y in range(cave_y_res * (ground_heights[x] - 2)):
-                    world_y = world_gen['height'] - (y/cave_y_res) - 2
+    carved = {}
+    for (x, y) in air_points:
+        carved.setdefault(x, set()).add(int(y))
 
-                    n_neighbours = 0
-                    for dx in (-1, 0, 1):
-                        for dy in (-(1/cave_y_res), 0, (1/cave_y_res)):
-                            if (x + dx, world_y + dy) in air_points:
-                                n_neighbours += 1
+    return {x: sorted(ys, reverse=True) for x, ys in carved.items()}
 
-                    if n_neighbours < 5:
-                        new_air_points.add((x, world_y))
+def gen_cave_feature(chunk_pos, ground_heights, meta):
+    x_min = chunk_pos - CA_ITERATIONS
+    x_max = chunk_pos + world_gen['chunk_size'] + CA_ITERATIONS
 
-            air_points = new_air_points
+    features.ensure(CaveAir, x_min, x_max, lambda x: gen_cave_air_feature(x, ground_heights, meta))
 
-        features[chunk_pos]['cave'] = air_points
+    row_counts = [CAVE_Y_RES * (ground_heights[x] - 2) for x in range(x_min, x_max)]
+    initial_rows = [features.get(CaveAir, x).rows for x in range(x_min, x_max)]
 
+    return Cave(x=chunk_pos, carved=cave_automaton(x_min, row_counts, initial_rows,
+        CA_ITERATIONS, world_gen['height'], CAVE_Y_RES))
 
 
 def build_tree(chunk, chunk_pos, x, tree_feature, ground_heights):
@@ -376,11 +414,11 @@ def build_tree(chunk, chunk_pos, x, tree_feature, ground_heights):
     # Add trunk
     if in_chunk(x, chunk_pos):
         air_height = world_gen['height'] - ground_heights[x]
-        for trunk_y in range(air_height - tree_feature['height'], air_height - (bool(DEBUG) * 3)):
+        for trunk_y in range(air_height - tree_feature.height, air_height - (bool(DEBUG) * 3)):
             chunk[x][trunk_y] = spawn_hierarchy(('|', chunk[x][trunk_y]))
 
     # Add leaves
-    leaves = world_gen['trees'][tree_feature['type']]['leaves']
+    leaves = world_gen['trees'][tree_feature.type]['leaves']
     half_leaves = int(len(leaves) / 2)
 
     for leaf_dx, leaf_slice in enumerate(leaves):
@@ -388,7 +426,7 @@ def build_tree(chunk, chunk_pos, x, tree_feature, ground_heights):
 
         if in_chunk(leaf_x, chunk_pos):
             air_height = world_gen['height'] - ground_heights[x]
-            leaf_height = air_height - tree_feature['height'] - len(leaf_slice) + tree_feature['trunk_depth']
+            leaf_height = air_height - tree_feature.height - len(leaf_slice) + tree_feature.trunk_depth
 
             for leaf_dy, leaf in enumerate(leaf_slice):
                 if (bool(DEBUG) and leaf_dy == 0) or (not bool(DEBUG) and leaf):
@@ -408,14 +446,14 @@ def build_ore(chunk, chunk_pos, x, ore_feature, ore, ground_heights):
     """ Adds an ore feature at x to the chunk. """
 
     for block_pos in range(ore['vain_size'] ** 2):
-        if ore_feature['vain_shape'][block_pos] < ore['vain_density']:
+        if ore_feature.vain_shape[block_pos] < ore['vain_density']:
 
             # Centre on root ore
             block_dx = (block_pos % ore['vain_size']) - int((ore['vain_size'] - 1) / 2)
             block_dy = int(block_pos / ore['vain_size']) - int((ore['vain_size'] - 1) / 2)
 
             block_x = block_dx + x
-            block_y = block_dy + ore_feature['root_height']
+            block_y = block_dy + ore_feature.root_height
 
             if not in_chunk(block_x, chunk_pos):
                 continue
@@ -432,40 +470,56 @@ def build_ore(chunk, chunk_pos, x, ore_feature, ore, ground_heights):
 def build_cave(chunk, chunk_pos, x, cave_feature, ground_heights):
     """ Adds caves at x to the chunk. """
 
-    for (world_x, y) in cave_feature:
+    for world_x, ys in cave_feature.carved.items():
         if in_chunk(world_x, chunk_pos):
-            chunk[world_x][int(y)] = ' '
+            for y in ys:
+                chunk[world_x][y] = ' '
 
 
-def gen_chunk(chunk_n, meta):
-    chunk_pos = chunk_n * world_gen['chunk_size']
+def gen_v1_features(chunk_pos, x_min, x_max, name, generator):
+    """ Adds the features called name between x_min and x_max to features_v1, if they aren't already there. """
+
+    for x in range(chunk_pos + x_min, chunk_pos + world_gen['chunk_size'] + x_max):
+        if features_v1.get(x) is None:
+            # Init to empty, so 'no features' is cached.
+            features_v1[x] = {}
 
-    # TODO: Allow more than one feature per x in features?
+        # If it is not None, it has all ready been generated.
+        if features_v1[x].get(name) is None:
+            feature = generator(x)
+            if feature is not None:
+                features_v1[x][name] = feature
 
-    # First generate all the features we will need
-    #   for all the slice is in this chunk
 
-    gen_biome_features(features, chunk_pos, meta)
-    gen_hill_features(features, chunk_pos, meta)
+def gen_chunk_v1(chunk_n, meta):
+    """
+        The generator version 1 saves were made with. Its ground heights, and
+            the features it builds, come from whatever earlier chunks left in
+            features_v1, so it must be kept as it is for their new chunks to
+            match the ones already saved.
+    """
+
+    chunk_pos = chunk_n * world_gen['chunk_size']
+
+    gen_v1_features(chunk_pos, -world_gen['max_biome'], world_gen['max_biome'], 'biome', lambda x: gen_biome_feature(x, meta))
+    gen_v1_features(chunk_pos, -MAX_HILL_RAD, MAX_HILL_RAD, 'hill', lambda x: gen_hill_feature(x, meta))
 
     # Generate hill heights and biomes map for the tree and ore generation.
     ground_heights = {x: world_gen['ground_height'] for x in range(chunk_pos - MAX_HILL_RAD, chunk_pos + world_gen['chunk_size'] + MAX_HILL_RAD)}
     # Store feature_x with the value for calculating precedence.
     slices_biome = {x: ('normal', None) for x in range(chunk_pos - world_gen['max_biome'], chunk_pos + world_gen['chunk_size'] + world_gen['max_biome'])}
 
-    for feature_x, slice_features in features.items():
-        feature_x = int(feature_x)
-
+    for feature_x, slice_features in features_v1.items():
         for feature_name, feature in slice_features.items():
 
             if feature_name == 'hill':
 
-                for d_x in range(-feature['height'] * feature['gradient_l'],
-                                 feature['height'] * feature['gradient_r']):
+                for d_x in range(-feature.height * feature.gradient_l,
+                                 feature.height * feature.gradient_r):
                     x = feature_x + d_x
 
-                    gradient = feature['gradient_l'] if d_x < 0 else feature['gradient_r']
-                    hill_height = int(feature['height'] - (abs(d_x) / gradient))
+                    gradient = feature.gradient_l if d_x < 0 else feature.gradient_r
+                    hill_height = int(feature.height - (abs(d_x) / gradient))
 
                     if d_x == 0:
                         hill_height -= 1
@@ -477,7 +531,7 @@ def gen_chunk(chunk_n, meta):
 
             elif feature_name == 'biome':
 
-                for d_x in range(-feature['radius'], feature['radius']):
+                for d_x in range(-feature.radius, feature.radius):
                     x = feature_x + d_x
 
                     if x in slices_biome:
@@ -485,7 +539,7 @@ def gen_chunk(chunk_n, meta):
 
                         if (previous_slice_biome_feature_x is None or
                                 previous_slice_biome_feature_x < feature_x):
-                            slices_biome[x] = (feature['type'], feature_x)
+                            slices_biome[x] = (feature.type, feature_x)
 
     chunk = {}
     for x in range(chunk_pos, chunk_pos + world_gen['chunk_size']):
@@ -496,27 +550,27 @@ def gen_chunk(chunk_n, meta):
             ['_']
         )
 
-    int_x = list(map(int, ground_heights.keys()))
     log('chunk', chunk_pos, m=1)
-    log('max', max(int_x), m=1)
-    log('min', min(int_x), m=1)
-    log('gh diff', set(range(chunk_pos - MAX_HILL_RAD, chunk_pos + world_gen['chunk_size'] + MAX_HILL_RAD)) - set(int_x), m=1, trunc=False)
-    log('slices_biome', list(filter(lambda slice_: (int(slice_[0])%16 == 0) or (int(slice_[0])+1)%16 == 0, sorted(slices_biome.items()))), m=1, trunc=False)
-
-    gen_cave_features(features, ground_heights, slices_biome, chunk_pos, meta)
-    gen_tree_features(features, ground_heights, slices_biome, chunk_pos, meta)
-    gen_ore_features(features, ground_heights, slices_biome, chunk_pos, meta)
-    gen_grass_features(features, ground_heights, slices_biome, chunk_pos, meta)
-
-    log('chunk_pos', chunk_pos, m=1)
-    tree_features = list(filter(lambda f: f[1].get('tree'), features.items()))
-    log('trees in cache\n', [str(f[0]) for f in tree_features], m=1, trunc=0)
-    log('trees in range', [str(f[0]) for f in tree_features if (chunk_pos <= int(f[0]) < chunk_pos + world_gen['chunk_size'])], m=1, trunc=0)
-
-    # Insert trees and ores
-    for feature_x, slice_features in features.items():
-        feature_x = int(feature_x)
 
+    # Caves from the initial air rows of this chunk and CA_ITERATIONS either side.
+    gen_v1_features(chunk_pos, -CA_ITERATIONS, CA_ITERATIONS, 'cave_initial_air_rows', lambda x: gen_cave_air_feature(x, ground_heights, meta))
+    if features_v1[chunk_pos].get('cave') is None:
+        xs = range(chunk_pos - CA_ITERATIONS, chunk_pos + world_gen['chunk_size'] + CA_ITERATIONS)
+        row_counts = [CAVE_Y_RES * (ground_heights[x] - 2) for x in xs]
+        initial_rows = [features_v1[x]['cave_initial_air_rows'].rows for x in xs]
+        features_v1[chunk_pos]['cave'] = Cave(x=chunk_pos, carved=cave_automaton(xs[0], row_counts, initial_rows,
+            CA_ITERATIONS, world_gen['height'], CAVE_Y_RES))
+
+    gen_v1_features(chunk_pos, -MAX_HALF_TREE, MAX_HALF_TREE, 'tree', lambda x: gen_tree_feature(x, ground_heights, slices_biome, meta))
+    for name, ore in world_gen['ores'].items():
+        gen_v1_features(chunk_pos, -MAX_ORE_RANGE[0], MAX_ORE_RANGE[1], name + '_ore_root',
+            lambda x: gen_ore_feature(x, name, ore, ground_heights, meta))
+    gen_v1_features(chunk_pos, 0, 0, 'grass', lambda x: gen_grass_feature(x, ground_heights, slices_biome, meta))
+
+    ores = {name + '_ore_root': (name, ore) for name, ore in world_gen['ores'].items()}
+
+    # Insert trees and ores, in the order they were cached
+    for feature_x, slice_features in features_v1.items():
         for feature_name, feature in slice_features.items():
 
             if feature_name == 'tree':
@@ -528,12 +582,96 @@ def gen_chunk(chunk_n, meta):
             elif feature_name == 'cave':
                 build_cave(chunk, chunk_pos, feature_x, feature, ground_heights)
 
-            else:
-                for name, ore in world_gen['ores'].items():
-                    ore_name = name + '_ore_root'
-
-                    if feature_name == ore_name:
-                        build_ore(chunk, chunk_pos, feature_x, feature, ore, ground_heights)
-                        break
+            elif feature_name in ores:
+                build_ore(chunk, chunk_pos, feature_x, feature, ores[feature_name][1], ground_heights)
 
     return chunk, {x: s for x, s in ground_heights.items() if x in range(chunk_pos, chunk_pos+world_gen['chunk_size'])}
+
+
+def gen_chunk(chunk_n, meta):
+    if meta.get('world_gen_version', 1) < 2:
+        return gen_chunk_v1(chunk_n, meta)
+
+    chunk_pos = chunk_n * world_gen['chunk_size']
+    chunk_end = chunk_pos + world_gen['chunk_size']
+
+    # Ground heights and biomes are needed a little outside the chunk, for the
+    #   features which overlap into it.
+    margin_min = chunk_pos - FEATURE_MARGIN
+    margin_max = chunk_end + FEATURE_MARGIN
+
+    hill_range = (margin_min - MAX_HILL_RAD, margin_max + MAX_HILL_RAD)
+    biome_range = (margin_min - world_gen['max_biome'], margin_max + world_gen['max_biome'])
+
+    # Generate hill heights and biomes map for the tree and ore generation.
+    features.ensure(Hill, *hill_range, lambda x: gen_hill_feature(x, meta))
+    features.ensure(Biome, *biome_range, lambda x: gen_biome_feature(x, meta))
+
+    ground_heights = {x: world_gen['ground_height'] for x in range(margin_min, margin_max)}
+    # Store feature_x with the value for calculating precedence.
+    slices_biome = {x: ('normal', None) for x in range(margin_min, margin_max)}
+
+    for hill in features.query(Hill, *hill_range):
+        for d_x in range(-hill.height * hill.gradient_l,
+                         hill.height * hill.gradient_r):
+            x = hill.x + d_x
+
+            if x in ground_heights:
+                gradient = hill.gradient_l if d_x < 0 else hill.gradient_r
+                hill_height = int(hill.height - (abs(d_x) / gradient))
+
+                if d_x == 0:
+                    hill_height -= 1
+
+                ground_heights[x] = max(world_gen['ground_height'] + hill_height, ground_heights[x])
+
+    for biome in features.query(Biome, *biome_range):
+        for d_x in range(-biome.radius, biome.radius):
+            x = biome.x + d_x
+
+            if x in slices_biome:
+                previous_slice_biome_feature_x = slices_biome[x][1]
+
+                if (previous_slice_biome_feature_x is None or
+                        previous_slice_biome_feature_x < biome.x):
+                    slices_biome[x] = (biome.type, biome.x)
+
+    chunk = {}
+    for x in range(chunk_pos, chunk_end):
+        chunk[x] = (
+            [' '] * (world_gen['height'] - ground_heights[x]) +
+            ['-'] +
+            ['#'] * (ground_heights[x] - 2) +  # 2 for grass and bedrock
+            ['_']
+        )
+
+    log('chunk', chunk_pos, m=1)
+    log('slices_biome', list(filter(lambda slice_: (int(slice_[0])%16 == 0) or (int(slice_[0])+1)%16 == 0, sorted(slices_biome.items()))), m=1, trunc=False)
+
+    tree_range = (chunk_pos - MAX_HALF_TREE, chunk_end + MAX_HALF_TREE)
+    ore_range = (chunk_pos - MAX_ORE_RANGE[0], chunk_end + MAX_ORE_RANGE[1])
+
+    # Generate the features which can overlap this chunk
+    features.ensure(Cave, chunk_pos, chunk_pos + 1, lambda x: gen_cave_feature(x, ground_heights, meta))
+    features.ensure(Tree, *tree_range, lambda x: gen_tree_feature(x, ground_heights, slices_biome, meta))
+    features.ensure(Grass, chunk_pos, chunk_end, lambda x: gen_grass_feature(x, ground_heights, slices_biome, meta))
+    for name, ore in world_gen['ores'].items():
+        features.ensure((Ore, name), *ore_range, lambda x: gen_ore_feature(x, name, ore, ground_heights, meta))
+
+    # Insert caves, trees and ores
+    for cave in features.query(Cave, chunk_pos, chunk_pos + 1):
+        build_cave(chunk, chunk_pos, cave.x, cave, ground_heights)
+
+    trees = list(features.query(Tree, *tree_range))
+    log('trees in range', [tree.x for tree in trees], m=1, trunc=0)
+    for tree in trees:
+        build_tree(chunk, chunk_pos, tree.x, tree, ground_heights)
+
+    for grass in features.query(Grass, chunk_pos, chunk_end):
+        build_grass(chunk, chunk_pos, grass.x, grass, ground_heights)
+
+    for name, ore in world_gen['ores'].items():
+        for ore_feature in features.query((Ore, name), *ore_range):
+            build_ore(chunk, chunk_pos, ore_feature.x, ore_feature, ore, ground_heights)
+
+    return chunk, {x: s for x, s in ground_heights.items() if chunk_pos <= x < chunk_end}
@@ -0,0 +1,369 @@
+#include <Python.h>
+#include <limits.h>
+#include <stdint.h>
+
+
+// SplitMix64, see hashrandom.py for the Python version which this must match.
+#define GAMMA 0x9e3779b97f4a7c15ULL
+#define DOUBLE_UNIT (1.0 / (double)(1ULL << 53))
+
+#define MAX_CAVE_ROWS 4096
+
+
+PyObject *C_TERRAIN_EXCEPTION;
+
+
+static inline uint64_t
+mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+static inline uint64_t
+hash64(uint64_t seed, int64_t x, int64_t y, uint64_t feature)
+{
+    uint64_t h = mix(seed ^ feature);
+    h = mix(h + (uint64_t)x * GAMMA);
+    return mix(h + (uint64_t)y * GAMMA);
+}
+
+
+static inline double
+uniform(uint64_t seed, int64_t x, int64_t y, uint64_t feature)
+{
+    return (hash64(seed, x, y, feature) >> 11) * DOUBLE_UNIT;
+}
+
+
+static PyObject *
+py_hash64(PyObject *self, PyObject *args)
+{
+    unsigned long long seed, feature;
+    long long x, y;
+
+    if (!PyArg_ParseTuple(args, "KLLK:hash64", &seed, &x, &y, &feature))
+    {
+        PyErr_SetString(C_TERRAIN_EXCEPTION, "Could not parse arguments!");
+        return NULL;
+    }
+
+    return PyLong_FromUnsignedLongLong(hash64(seed, x, y, feature));
+}
+
+
+static PyObject *
+py_uniform(PyObject *self, PyObject *args)
+{
+    unsigned long long seed, feature;
+    long long x, y;
+
+    if (!PyArg_ParseTuple(args, "KLLK:uniform", &seed, &x, &y, &feature))
+    {
+        PyErr_SetString(C_TERRAIN_EXCEPTION, "Could not parse arguments!");
+        return NULL;
+    }
+
+    return PyFloat_FromDouble(uniform(seed, x, y, feature));
+}
+
+
+static PyObject *
+threshold_column(PyObject *self, PyObject *args)
+{
+    unsigned long long seed, feature;
+    long long x, n;
+    double chance;
+
+    if (!PyArg_ParseTuple(args, "KLKLd:threshold_column", &seed, &x, &feature, &n, &chance))
+    {
+        PyErr_SetString(C_TERRAIN_EXCEPTION, "Could not parse arguments!");
+        return NULL;
+    }
+
+    PyObject *result = PyList_New(0);
+    if (!result)
+        return NULL;
+
+    long long y;
+    for (y = 0; y < n; ++y)
+    {
+        if (uniform(seed, x, y, feature) < chance)
+        {
+            PyObject *py_y = PyLong_FromLongLong(y);
+            if (!py_y || PyList_Append(result, py_y) != 0)
+            {
+                Py_XDECREF(py_y);
+                Py_DECREF(result);
+                return NULL;
+            }
+            Py_DECREF(py_y);
+        }
+    }
+
+    return result;
+}
+
+
+// Adds the bit planes of `a` into the bit-sliced counter `sum`, one bit of
+//   the count per plane, for each of the 64 columns in parallel.
+static inline void
+add_plane(uint64_t sum[4], uint64_t a)
+{
+    uint64_t carry = a;
+    int i;
+    for (i = 0; i < 4 && carry; ++i)
+    {
+        uint64_t next_carry = sum[i] & carry;
+        sum[i] ^= carry;
+        carry = next_carry;
+    }
+}
+
+
+// Bit i of word w in a row is column w * 64 + i, these return the row
+//   shifted so each bit holds its left or right neighbour.
+static inline uint64_t
+left_neighbours(const uint64_t *row, size_t w)
+{
+    return (row[w] << 1) | (w > 0 ? row[w - 1] >> 63 : 0);
+}
+
+static inline uint64_t
+right_neighbours(const uint64_t *row, size_t w, size_t n_words)
+{
+    return (row[w] >> 1) | (w + 1 < n_words ? row[w + 1] << 63 : 0);
+}
+
+
+static PyObject *
+cave_automaton(PyObject *self, PyObject *args)
+{
+    long long x_min;
+    long iterations, height, y_res;
+    PyObject *py_row_counts, *py_initial_rows;
+
+    if (!PyArg_ParseTuple(args, "LOOlll:cave_automaton", &x_min, &py_row_counts, &py_initial_rows, &iterations, &height, &y_res))
+    {
+        PyErr_SetString(C_TERRAIN_EXCEPTION, "Could not parse arguments!");
+        return NULL;
+    }
+
+    PyObject *row_counts = PySequence_Fast(py_row_counts, "row_counts must be a sequence");
+    if (!row_counts)
+        return NULL;
+    PyObject *initial_rows = PySequence_Fast(py_initial_rows, "initial_rows must be a sequence");
+    if (!initial_rows)
+    {
+        Py_DECREF(row_counts);
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    uint64_t *grid = NULL, *new_grid = NULL, *valid = NULL;
+
+    long width = PySequence_Fast_GET_SIZE(row_counts);
+    if (PySequence_Fast_GET_SIZE(initial_rows) != width)
+    {
+        PyErr_SetString(C_TERRAIN_EXCEPTION, "row_counts and initial_rows must be the same length!");
+        goto done;
+    }
+
+    long n_rows = 0;
+    long x;
+    for (x = 0; x < width; ++x)
+    {
+        long count = PyLong_AsLong(PySequence_Fast_GET_ITEM(row_counts, x));
+        if (count == -1 && PyErr_Occurred())
+            goto done;
+        if (count > n_rows)
+            n_rows = count;
+    }
+
+    if (n_rows > MAX_CAVE_ROWS)
+    {
+        PyErr_SetString(C_TERRAIN_EXCEPTION, "Too many cave rows!");
+        goto done;
+    }
+
+    // One padding row above and below, so the kernel doesn't need bounds checks.
+    size_t n_words = (width + 63) / 64;
+    size_t stride = n_words;
+    size_t grid_size = (n_rows + 2) * stride;
+
+    grid = (uint64_t *)calloc(grid_size, sizeof(uint64_t));
+    new_grid = (uint64_t *)calloc(grid_size, sizeof(uint64_t));
+    valid = (uint64_t *)calloc(grid_size, sizeof(uint64_t));
+    if (!grid || !new_grid || !valid)
+    {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    #define ROW(buffer, r) ((buffer) + ((r) + 1) * stride)
+
+    for (x = 0; x < width; ++x)
+    {
+        long count = PyLong_AsLong(PySequence_Fast_GET_ITEM(row_counts, x));
+        uint64_t bit = 1ULL << (x % 64);
+        long r;
+        for (r = 0; r < count; ++r)
+        {
+            ROW(valid, r)[x / 64] |= bit;
+        }
+
+        PyObject *rows = PySequence_Fast(PySequence_Fast_GET_ITEM(initial_rows, x), "initial_rows must contain sequences");
+        if (!rows)
+            goto done;
+
+        Py_ssize_t i;
+        for (i = 0; i < PySequence_Fast_GET_SIZE(rows); ++i)
+        {
+            r = PyLong_AsLong(PySequence_Fast_GET_ITEM(rows, i));
+            if (r >= 0 && r < count)
+            {
+                ROW(grid, r)[x / 64] |= bit;
+            }
+        }
+        Py_DECREF(rows);
+
+        if (PyErr_Occurred())
+            goto done;
+    }
+
+    long i;
+    for (i = 0; i < iterations; ++i)
+    {
+        long r;
+        for (r = 0; r < n_rows; ++r)
+        {
+            size_t w;
+            for (w = 0; w < n_words; ++w)
+            {
+                uint64_t sum[4] = {0, 0, 0, 0};
+
+                long dr;
+                for (dr = -1; dr <= 1; ++dr)
+                {
+                    const uint64_t *row = ROW(grid, r + dr);
+                    add_plane(sum, left_neighbours(row, w));
+                    add_plane(sum, row[w]);
+                    add_plane(sum, right_neighbours(row, w, n_words));
+                }
+
+                // Cells with fewer than 5 air cells in their 3x3 become air.
+                uint64_t at_least_5 = sum[3] | (sum[2] & (sum[1] | sum[0]));
+                ROW(new_grid, r)[w] = ~at_least_5 & ROW(valid, r)[w];
+            }
+        }
+
+        uint64_t *tmp = grid;
+        grid = new_grid;
+        new_grid = tmp;
+    }
+
+    // Convert the rows back to block ys: x -> [y, ...]
+    result = PyDict_New();
+    if (!result)
+        goto done;
+
+    for (x = 0; x < width; ++x)
+    {
+        PyObject *ys = PyList_New(0);
+        if (!ys)
+        {
+            Py_CLEAR(result);
+            goto done;
+        }
+
+        uint64_t bit = 1ULL << (x % 64);
+        long last_y = LONG_MIN;
+        long r;
+        for (r = 0; r < n_rows; ++r)
+        {
+            if (ROW(grid, r)[x / 64] & bit)
+            {
+                long y = (long)(height - ((double)r / y_res) - 2);
+                if (y != last_y)
+                {
+                    PyObject *py_y = PyLong_FromLong(y);
+                    if (!py_y || PyList_Append(ys, py_y) != 0)
+                    {
+                        Py_XDECREF(py_y);
+                        Py_DECREF(ys);
+                        Py_CLEAR(result);
+                        goto done;
+                    }
+                    Py_DECREF(py_y);
+                    last_y = y;
+                }
+            }
+        }
+
+        if (PyList_GET_SIZE(ys) > 0)
+        {
+            PyObject *py_x = PyLong_FromLongLong(x_min + x);
+            if (!py_x || PyDict_SetItem(result, py_x, ys) != 0)
+            {
+                Py_XDECREF(py_x);
+                Py_DECREF(ys);
+                Py_CLEAR(result);
+                goto done;
+            }
+            Py_DECREF(py_x);
+        }
+        Py_DECREF(ys);
+    }
+
+    #undef ROW
+
+done:
+    free(grid);
+    free(new_grid);
+    free(valid);
+    Py_DECREF(row_counts);
+    Py_DECREF(initial_rows);
+    return result;
+}
+
+
+static PyMethodDef terrain_c_methods[] = {
+    {"hash64", py_hash64, METH_VARARGS, PyDoc_STR("hash64(seed, x, y, feature) -> int")},
+    {"uniform", py_uniform, METH_VARARGS, PyDoc_STR("uniform(seed, x, y, feature) -> float in [0, 1)")},
+    {"threshold_column", threshold_column, METH_VARARGS, PyDoc_STR("threshold_column(seed, x, feature, n, chance) -> [y for y in range(n) if uniform(seed, x, y, feature) < chance]")},
+    {"cave_automaton", cave_automaton, METH_VARARGS, PyDoc_STR("cave_automaton(x_min, row_counts, initial_rows, iterations, height, y_res) -> {x: [y, ...]}")},
+    {NULL, NULL}  /* sentinel */
+};
+
+PyDoc_STRVAR(module_doc, "Bulk world generation");
+
+static struct PyModuleDef terrain_c_module = {
+    PyModuleDef_HEAD_INIT,
+    "terrain_c",
+    module_doc,
+    -1,
+    terrain_c_methods,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+PyMODINIT_FUNC
+PyInit_terrain_c(void)
+{
+    PyObject *m = NULL;
+
+    // Create the module and add the functions
+    m = PyModule_Create(&terrain_c_module);
+    if (m == NULL)
+    {
+        Py_XDECREF(m);
+    }
+
+    C_TERRAIN_EXCEPTION = PyErr_NewException("terrain_c.TerrainException", NULL, NULL);
+
+    return m;
+}
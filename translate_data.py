@@ -61,12 +61,16 @@ get_block_data(char block_key)
 
     out += switch
 
-    out += "\n\nstatic long world_gen_height = {};".format(data.world_gen['height'])
-    out += "\n\nstatic Colour cave_colour = {{{{{}, {}, {}}}}};\n".format(*data.lighting['cave_colour'])
+    out += "\n\nstatic long world_gen_height = {};\n".format(data.world_gen['height'])
 
     return out
 
 
+def translate_lighting():
+    """ The lighting data, kept out of data.c as only the renderer uses it. """
+    return "static Colour cave_colour = {{{{{}, {}, {}}}}};\n".format(*data.lighting['cave_colour'])
+
+
 def main():
     print(translate())
 